@@ -0,0 +1,66 @@
+// Micro benchmark of /users/<id>/visits rendering: schema serializer vs WrSerializer with PutChars and Print,
+// as it was rendered before. Reports ns per list and per row for lists of different length.
+// Usage: bench_json [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "cbinding/serializer.h"
+#include "dictionary.h"
+#include "json_schema.h"
+#include "response_schemas.h"
+
+using reindexer::WrSerializer;
+
+static size_t renderWrSerializer(const std::vector<VisitPlace> &rows, const StringDict &dict) {
+	WrSerializer wrSer(true);
+	wrSer.PutChars("{\"visits\":[");
+	for (size_t i = 0; i < rows.size(); i++) {
+		if (i) wrSer.PutChar(',');
+		wrSer.PutChars("{\"visited_at\":");
+		wrSer.Print(rows[i].visited_at);
+		wrSer.PutChars(",\"mark\":");
+		wrSer.Print(rows[i].mark);
+		wrSer.PutChars(",\"place\":\"");
+		wrSer.PutChars(dict.JSON(rows[i].place));
+		wrSer.PutChars("\"}");
+	}
+	wrSer.PutChars("]}");
+	return wrSer.Len();
+}
+
+static size_t renderSchema(const std::vector<VisitPlace> &rows, const StringDict &dict) {
+	static std::string out;
+	jsonschema::RenderList<VisitPlaceJSON::Schema>("{\"visits\":[", rows.data(), rows.data() + rows.size(), dict, out);
+	return out.size();
+}
+
+template <typename F>
+static void bench(const char *name, const std::vector<VisitPlace> &rows, const StringDict &dict, int iters, F render) {
+	size_t bytes = 0;
+	auto tmStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < iters; i++) bytes += render(rows, dict);
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - tmStart).count() / iters;
+	printf("%-14s %5d rows %10.1f ns/list %6.1f ns/row %7d bytes\n", name, int(rows.size()), ns, ns / std::max(size_t(1), rows.size()),
+		   int(bytes / iters));
+}
+
+int main(int argc, char **argv) {
+	int iters = argc > 1 ? atoi(argv[1]) : 20000;
+	StringDict dict;
+	const char *places[] = {"Музей", "Набережная", "Замок", "Ратуша", "Мост \"Старый\""};
+	uint32_t codes[5];
+	for (int i = 0; i < 5; i++) codes[i] = dict.Put(places[i]);
+
+	for (int n : {1, 10, 100, 1000}) {
+		std::vector<VisitPlace> rows;
+		for (int i = 0; i < n; i++) rows.push_back(VisitPlace{1000000000 + i * 86400, i % 6, codes[i % 5]});
+		int listIters = std::max(1, iters * 10 / (n + 9));
+		bench("wrserializer", rows, dict, listIters, renderWrSerializer);
+		bench("schema", rows, dict, listIters, renderSchema);
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+// Micro benchmark of visit filter kernels vs the same filter done by reindexer Select.
+// Usage: bench_kernels [rows]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "core/reindexer.h"
+#include "kernels.h"
+
+using namespace reindexer;
+using std::vector;
+
+struct Columns {
+	vector<int32_t> birthDate;
+	vector<char> gender;
+	vector<int8_t> mark;
+};
+
+static const int kFromBirthDate = 300000000;
+static const int kToBirthDate = 900000000;
+
+template <typename F>
+static double rowsPerSec(int rows, F f) {
+	// Repeat until measurement is long enough to be stable
+	int iters = 0;
+	auto tmStart = std::chrono::steady_clock::now();
+	double sec = 0;
+	do {
+		f();
+		iters++;
+		sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - tmStart).count();
+	} while (sec < 0.5);
+	return double(rows) * iters / sec;
+}
+
+static void benchKernels(const Columns &c, int rows) {
+	static const int kBlockSize = 1024;
+	uint64_t mask[kBlockSize / 64];
+	volatile int64_t sink = 0;
+
+	for (auto impl : {kernels::ImplScalar, kernels::ImplSSE41, kernels::ImplAVX2}) {
+		if (!kernels::SetImpl(impl)) {
+			printf("%-8s not supported by cpu\n", kernels::ImplName(impl));
+			continue;
+		}
+		auto scan = [&](bool byBirthDate, bool byGender, bool sum) {
+			return rowsPerSec(rows, [&]() {
+				int64_t s = 0;
+				int cnt = 0;
+				for (int beg = 0; beg < rows; beg += kBlockSize) {
+					int n = std::min(kBlockSize, rows - beg);
+					kernels::InitMask(mask, n);
+					if (byBirthDate) kernels::AndRange(&c.birthDate[beg], n, kFromBirthDate, kToBirthDate, mask);
+					if (byGender) kernels::AndEq(&c.gender[beg], n, 'm', mask);
+					if (sum) kernels::MaskedSum(&c.mark[beg], n, mask, s, cnt);
+				}
+				sink = sink + s + cnt + mask[0];
+			});
+		};
+		printf("%-8s range %8.1fM rows/s, eq %8.1fM rows/s, masked sum %8.1fM rows/s, avg filter %8.1fM rows/s\n", kernels::ImplName(impl),
+			   scan(true, false, false) / 1e6, scan(false, true, false) / 1e6, scan(false, false, true) / 1e6, scan(true, true, true) / 1e6);
+	}
+}
+
+static void benchSelect(const Columns &c, int rows) {
+	Reindexer db;
+	IndexOpts oppk{0, 1};
+	db.AddNamespace("visits");
+	db.AddIndex("visits", "id", "id", IndexIntHash, &oppk);
+	db.AddIndex("visits", "location", "location", IndexIntHash);
+	db.AddIndex("visits", "mark", "mark", IndexIntStore);
+	db.AddIndex("visits", "gender", "gender", IndexStrStore);
+	db.AddIndex("visits", "birth_date", "birth_date", IndexIntStore);
+
+	unique_ptr<Item> it(db.NewItem("visits"));
+	it->FromJSON(string("{\"id\": 0, \"location\": 0, \"mark\": 0, \"gender\": \"\", \"birth_date\": 0}"));
+	for (int i = 0; i < rows; i++) {
+		char gender[2] = {c.gender[i], 0};
+		it->Clone();
+		it->SetField("id", KeyRef(i));
+		it->SetField("location", KeyRef(1));
+		it->SetField("mark", KeyRef(int(c.mark[i])));
+		it->SetField("gender", KeyRef(p_string(gender)));
+		it->SetField("birth_date", KeyRef(c.birthDate[i]));
+		db.Upsert("visits", it.get());
+	}
+
+	double rps = rowsPerSec(rows, [&]() {
+		QueryResults res;
+		db.Select(Query("visits")
+					  .Where("location", CondEq, 1)
+					  .Where("birth_date", CondGt, kFromBirthDate)
+					  .Where("birth_date", CondLt, kToBirthDate)
+					  .Where("gender", CondEq, "m")
+					  .Aggregate("mark", AggAvg),
+				  res);
+	});
+	printf("%-8s avg filter %8.1fM rows/s\n", "select", rps / 1e6);
+}
+
+int main(int argc, char **argv) {
+	int rows = argc > 1 ? atoi(argv[1]) : 1000000;
+	Columns c;
+	srand(1);
+	for (int i = 0; i < rows; i++) {
+		c.birthDate.push_back(rand() % 1200000000);
+		c.gender.push_back(rand() % 2 ? 'm' : 'f');
+		c.mark.push_back(rand() % 6);
+	}
+	printf("%d rows\n", rows);
+	benchKernels(c, rows);
+	benchSelect(c, rows);
+	return 0;
+}
@@ -0,0 +1,100 @@
+#!/bin/sh
+# Compares throughput and p99 latency of server with different loop thread counts, cpu pinning and SO_REUSEPORT.
+# Server and hlcup_bench must be built and data must be in place (see main.cc). Needs curl.
+# Usage: bench/listener_bench.sh [url path] [requests] [pipeline depth]
+#
+# With compare, measures server side read and write syscalls per request of two revisions at pipeline depths 1 and 8,
+# e.g. of the listener before and after batching of pipelined responses:
+#   bench/listener_bench.sh compare 1568fcc^ 1568fcc
+# Each revision is built in its own worktree against reindexer of this checkout. Syscalls are deltas of io_syscalls
+# of /stats over the run, which older revisions count from /proc/self/io, so they include the few non-socket ones.
+# Usage: bench/listener_bench.sh compare <before revision> <after revision> [url path] [requests]
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BENCH=$ROOT/hlcup_bench
+if [ "$1" = compare ]; then
+	BEFORE=${2:?before revision}
+	AFTER=${3:?after revision}
+	shift 3
+fi
+URL_PATH=${1:-/users/1}
+REQUESTS=${2:-500000}
+DEPTH=${3:-1}
+SERVER=$ROOT/hlcup_reindex
+AMMO=$(mktemp)
+WORK=$(mktemp -d)
+trap 'rm -rf $AMMO $WORK' EXIT
+
+# Ammo of the same GET, in format of tank: size and tag line, then request
+awk -v n=$REQUESTS -v path=$URL_PATH 'BEGIN {
+	req = "GET " path " HTTP/1.1\r\nHost: localhost\r\nUser-Agent: hlcup_bench\r\n\r\n"
+	for (i = 0; i < n; i++) printf "%d /\n%s\n", length(req), req
+}' >$AMMO
+
+# Starts server binary $1 with environment of the rest args, and waits until data is loaded and port is listened
+start() {
+	bin=$1
+	shift
+	env "$@" $bin 2>$WORK/log &
+	pid=$!
+	until curl -s -o /dev/null http://127.0.0.1$URL_PATH; do
+		kill -0 $pid 2>/dev/null || { echo "server exited"; cat $WORK/log; exit 1; }
+		sleep 1
+	done
+}
+
+stop() {
+	kill $pid
+	wait $pid 2>/dev/null
+}
+
+# Sum of read and write syscalls from /stats of running server
+syscalls() {
+	curl -s http://127.0.0.1/stats | sed -n 's/.*"io_syscalls":{"read":\([0-9]*\),"write":\([0-9]*\).*/\1 \2/p' |
+		awk '{print $1 + $2}'
+}
+
+run() {
+	start $SERVER HTTP_THREADS=$1 HTTP_PIN_CPUS=$2 HTTP_REUSEPORT=$3
+	$BENCH -p 80 -c 256 -d $DEPTH $AMMO |
+		awk -v t=$1 -v p=$2 -v r=$3 '$1 == "GET" {printf "threads %2d pin %d reuseport %d: %10s req/s, p99 %sus\n", t, p, r, $4, $7}'
+	stop
+}
+
+measure() {
+	rev=$1
+	dir=$WORK/$(echo "$rev" | tr -c 'a-zA-Z0-9\n' _)
+	git -C "$ROOT" worktree add -q --detach "$dir" "$rev" || exit 1
+	ln -s "$ROOT/reindexer" "$dir/reindexer"
+	if ! make -s -C "$dir" -j"$(nproc)" >/dev/null; then
+		echo "$rev: build failed"
+		git -C "$ROOT" worktree remove --force "$dir"
+		exit 1
+	fi
+
+	# Snapshot of other revision must not be reused, so each run loads data from json
+	rm -f /tmp/hlcup_reindex.snapshot
+	start "$dir/hlcup_reindex"
+	for depth in 1 8; do
+		before=$(syscalls)
+		rps=$($BENCH -p 80 -c 256 -d $depth $AMMO | awk '$1 == "GET" {print $4}')
+		after=$(syscalls)
+		printf "%-12s depth %d: %10s req/s, %s syscalls/request\n" "$rev" $depth "$rps" \
+			"$(awk -v b="$before" -v a="$after" -v n=$REQUESTS 'BEGIN {if (b == "" || a == "") print "-"; else printf "%.2f", (a - b) / n}')"
+	done
+	stop
+	git -C "$ROOT" worktree remove --force "$dir"
+}
+
+if [ -n "$BEFORE" ]; then
+	measure "$BEFORE"
+	measure "$AFTER"
+	exit 0
+fi
+
+NCPU=$(nproc)
+for threads in 1 4 $NCPU; do
+	run $threads 0 0
+	run $threads 1 0
+	run $threads 1 1
+done
@@ -0,0 +1,90 @@
+// Replays tank ammo files against the server and reports per endpoint throughput and latency percentiles.
+// Files are replayed one after another, like phases of hlcup tests: phase_1_get.ammo phase_2_post.ammo phase_3_get.ammo
+// With -s storm ammo (e.g. POSTs) is replayed in loop on own connections at max rate, while files are measured,
+// so latency of GETs is measured under concurrent updates.
+// Usage: hlcup_bench [-h host] [-p port] [-c connections] [-r rps] [-d pipeline depth] [-s storm ammo] ammo...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include "loadgen.h"
+
+static const int kStormConnections = 8;
+
+int main(int argc, char **argv) {
+	LoadGen::Options opts{"127.0.0.1", 80, 100, 0, 1};
+	const char *stormPath = nullptr;
+	int opt;
+	while ((opt = getopt(argc, argv, "h:p:c:r:d:s:")) != -1) {
+		switch (opt) {
+			case 'h':
+				opts.host = optarg;
+				break;
+			case 'p':
+				opts.port = atoi(optarg);
+				break;
+			case 'c':
+				opts.connections = atoi(optarg);
+				break;
+			case 'r':
+				opts.rps = atoi(optarg);
+				break;
+			case 'd':
+				opts.pipeline = atoi(optarg);
+				break;
+			case 's':
+				stormPath = optarg;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-h host] [-p port] [-c connections] [-r rps] [-d pipeline depth] [-s storm ammo] ammo...\n",
+						argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "No ammo files\n");
+		return 1;
+	}
+
+	std::vector<Ammo> storm;
+	if (stormPath && !LoadAmmo(stormPath, storm)) {
+		fprintf(stderr, "Can't load ammo from %s\n", stormPath);
+		return 1;
+	}
+	std::atomic<bool> done(false);
+	LoadGen stormGen(LoadGen::Options{opts.host, opts.port, kStormConnections, 0, 1});
+	std::thread stormTh([&]() {
+		while (!storm.empty() && !done && stormGen.Run(storm)) {
+		}
+	});
+
+	LoadGen gen(opts);
+	int ret = 0;
+	for (int i = optind; i < argc; i++) {
+		std::vector<Ammo> ammo;
+		if (!LoadAmmo(argv[i], ammo)) {
+			fprintf(stderr, "Can't load ammo from %s\n", argv[i]);
+			ret = 1;
+			break;
+		}
+		printf("%s: %d requests, %d connections, %s\n", argv[i], int(ammo.size()), opts.connections,
+			   opts.rps ? (std::to_string(opts.rps) + " req/s").c_str() : "max rate");
+		if (!gen.Run(ammo)) {
+			fprintf(stderr, "Can't connect to %s:%d\n", opts.host.c_str(), opts.port);
+			ret = 1;
+			break;
+		}
+		gen.Report(stdout);
+	}
+
+	// The last replay of storm is finished, and reported
+	done = true;
+	stormTh.join();
+	if (!storm.empty()) {
+		printf("%s: storm, %d requests, %d connections\n", stormPath, int(storm.size()), kStormConnections);
+		stormGen.Report(stdout);
+	}
+	return ret;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Measures memory of server after load of full dataset at two revisions, e.g. of a change of namespaces layout:
+#   bench/mem_compare.sh e62bbd1^ e62bbd1
+# Each revision is built in its own worktree against reindexer of this checkout, and is started on data in /go/data.
+# Reported RSS is VmRSS of process once it's serving, and store_mb is store's own share, when /stats has it.
+# Needs curl, and port 80 must be free.
+# Usage: bench/mem_compare.sh <before revision> <after revision> [settle seconds]
+
+BEFORE=${1:?before revision}
+AFTER=${2:?after revision}
+SETTLE=${3:-10}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+
+measure() {
+	rev=$1
+	dir=$WORK/$(echo "$rev" | tr -c 'a-zA-Z0-9\n' _)
+	git -C "$ROOT" worktree add -q --detach "$dir" "$rev" || exit 1
+	ln -s "$ROOT/reindexer" "$dir/reindexer"
+	make -s -C "$dir" -j"$(nproc)" >/dev/null || { echo "$rev: build failed"; exit 1; }
+
+	# Snapshot of other revision must not be reused, so each run loads data from json
+	rm -f /tmp/hlcup_reindex.snapshot
+	"$dir/hlcup_reindex" 2>"$WORK/log" &
+	pid=$!
+	until curl -s -o /dev/null http://127.0.0.1/users/1; do
+		kill -0 $pid 2>/dev/null || { echo "$rev: server exited"; cat "$WORK/log"; exit 1; }
+		sleep 1
+	done
+	sleep "$SETTLE"
+	rss=$(awk '/VmRSS/ {print int($2 / 1024)}' /proc/$pid/status)
+	store=$(curl -s http://127.0.0.1/stats | sed -n 's/.*"store_mb":\([0-9]*\).*/\1/p')
+	printf "%-12s rss %6s MB  store %6s MB\n" "$rev" "$rss" "${store:--}"
+	kill $pid
+	wait $pid 2>/dev/null
+	git -C "$ROOT" worktree remove --force "$dir"
+}
+
+measure "$BEFORE"
+measure "$AFTER"
+rm -rf "$WORK"
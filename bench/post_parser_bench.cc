@@ -0,0 +1,66 @@
+// Micro benchmark of POST body parsing: schema aware entity parser vs gason.
+// Reports parse time and heap allocations per body, counted by tools/allocdebug.
+// Usage: bench_post_parser [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "entity_parser.h"
+#include "gason/gason.h"
+#include "tools/allocdebug.h"
+
+static const char *kUserBody =
+	"{\"first_name\": \"\\u041f\\u0451\\u0442\\u0440\", \"last_name\": \"\\u0424\\u0430\\u0443\\u0448\\u0443\\u0442\\u0438\\u043d\", "
+	"\"birth_date\": -1720915200, \"gender\": \"m\", \"id\": 1012, \"email\": \"foobar@mail.ru\"}";
+static const char *kLocationBody =
+	"{\"distance\": 6, \"city\": \"\\u041c\\u043e\\u0441\\u043a\\u0432\\u0430\", \"place\": \"\\u041c\\u0443\\u0437\\u0435\\u0439\", "
+	"\"id\": 777, \"country\": \"\\u0420\\u043e\\u0441\\u0441\\u0438\\u044f\"}";
+static const char *kVisitBody = "{\"user\": 44, \"location\": 32, \"visited_at\": 1103260218, \"id\": 1000, \"mark\": 4}";
+
+// Parser is destructive, so body is copied to stack buffer before each parse, as it's done by server
+template <typename F>
+static void bench(const char *name, const char *body, int iters, F parse) {
+	size_t len = strlen(body);
+	char buf[1024];
+	size_t allocs = get_alloc_cnt_total();
+	auto tmStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < iters; i++) {
+		memcpy(buf, body, len + 1);
+		if (!parse(buf, len)) {
+			printf("%s: parse failed\n", name);
+			exit(1);
+		}
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - tmStart).count();
+	printf("%-16s %8.1f ns/body, %5.2f allocs/body\n", name, ns / iters, double(get_alloc_cnt_total() - allocs) / iters);
+}
+
+template <typename T>
+static void benchEntity(const char *name, const char *body, int iters, bool (*parseEntity)(char *&, const char *, T &, unsigned &)) {
+	char title[64];
+	snprintf(title, sizeof(title), "%s entity", name);
+	bench(title, body, iters, [&](char *buf, size_t len) {
+		T rec;
+		unsigned fields;
+		char *p = buf;
+		return parseEntity(p, buf + len, rec, fields);
+	});
+
+	snprintf(title, sizeof(title), "%s gason", name);
+	bench(title, body, iters, [&](char *buf, size_t) {
+		JsonAllocator jallocator;
+		JsonValue jvalue;
+		char *pend;
+		return jsonParse(buf, &pend, &jvalue, jallocator) == JSON_OK;
+	});
+}
+
+int main(int argc, char **argv) {
+	int iters = argc > 1 ? atoi(argv[1]) : 1000000;
+	allocdebug_init();
+	benchEntity("users", kUserBody, iters, ParseUser);
+	benchEntity("locations", kLocationBody, iters, ParseLocation);
+	benchEntity("visits", kVisitBody, iters, ParseVisit);
+	return 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+// Bounded lock free MPMC queue (D. Vyukov's algorithm): each cell has a sequence number,
+// which tells producers and consumers whose turn is it. Capacity must be a power of 2.
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : cells_(new Cell[capacity]), mask_(capacity - 1), enqueuePos_(0), dequeuePos_(0) {
+		for (size_t i = 0; i < capacity; i++) cells_[i].seq.store(i, std::memory_order_relaxed);
+	}
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+	// Returns false if queue is full
+	bool Push(const T &val) {
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell &cell = cells_[pos & mask_];
+			size_t seq = cell.seq.load(std::memory_order_acquire);
+			intptr_t dif = intptr_t(seq) - intptr_t(pos);
+			if (dif == 0) {
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.val = val;
+					cell.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Returns false if queue is empty
+	bool Pop(T &val) {
+		size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell &cell = cells_[pos & mask_];
+			size_t seq = cell.seq.load(std::memory_order_acquire);
+			intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+			if (dif == 0) {
+				if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					val = cell.val;
+					cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = dequeuePos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Approximate number of queued elements
+	size_t Size() const { return enqueuePos_.load(std::memory_order_relaxed) - dequeuePos_.load(std::memory_order_relaxed); }
+
+protected:
+	struct Cell {
+		std::atomic<size_t> seq;
+		T val;
+	};
+
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_;
+	// Producers and consumer positions are on separate cache lines
+	alignas(64) std::atomic<size_t> enqueuePos_;
+	alignas(64) std::atomic<size_t> dequeuePos_;
+};
@@ -0,0 +1,116 @@
+#include "busy_poller.h"
+#include <algorithm>
+#include <chrono>
+
+// Bounds of spin window after the last request
+static const uint64_t kMinWindowUs = 100;
+static const uint64_t kMaxWindowUs = 20000;
+// Window is this number of average gaps between requests: loops don't park between requests of steady load
+static const uint64_t kWindowGaps = 4;
+
+static uint64_t nowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t window(uint64_t gapEwma) { return std::max(kMinWindowUs, std::min(kMaxWindowUs, gapEwma * kWindowGaps)); }
+
+BusyPoller::BusyPoller()
+	: used_(0),
+	  paused_(0),
+	  spins_(0),
+	  parks_(0),
+	  wakeups_(0),
+	  spinTime_(0),
+	  parkTime_(0),
+	  lastTick_(nowUs()) {
+	for (auto &s : slots_) {
+		s.lastActivity.store(0, std::memory_order_relaxed);
+		s.gapEwma.store(kMaxWindowUs, std::memory_order_relaxed);
+		s.wakeSamples.store(0, std::memory_order_relaxed);
+		s.wakeLatencySum.store(0, std::memory_order_relaxed);
+		s.wakeLatencyMax.store(0, std::memory_order_relaxed);
+		s.spinning.store(false, std::memory_order_relaxed);
+		s.used = false;
+	}
+}
+
+void BusyPoller::Activity() {
+	int index = ThreadIndex();
+	Slot &s = slots_[index];
+	if (!s.used) {
+		s.used = true;
+		int used = used_.load();
+		while (used <= index && !used_.compare_exchange_weak(used, index + 1)) {
+		}
+	}
+
+	// Slot is written by this thread only, so updates are plain stores
+	uint64_t now = nowUs();
+	uint64_t prev = s.lastActivity.load(std::memory_order_relaxed);
+	uint64_t gap = now > prev ? std::min(now - prev, kMaxWindowUs) : 0;
+	s.lastActivity.store(now, std::memory_order_relaxed);
+	s.gapEwma.store((s.gapEwma.load(std::memory_order_relaxed) * 7 + gap) / 8, std::memory_order_relaxed);
+
+	if (!s.spinning.load(std::memory_order_relaxed) && !paused_.load(std::memory_order_relaxed)) {
+		// Request has woken up parked loop. Start spinning right away, not on the next tick
+		wakeups_++;
+		switchTo(s, true);
+	}
+}
+
+// Wakeups are rare compared to requests, so their stats are updated atomically, and controller takes them
+void BusyPoller::Wakeup(uint64_t latencyUs) {
+	Slot &s = slots_[ThreadIndex()];
+	s.wakeSamples++;
+	s.wakeLatencySum += latencyUs;
+	uint64_t max = s.wakeLatencyMax.load(std::memory_order_relaxed);
+	while (latencyUs > max && !s.wakeLatencyMax.compare_exchange_weak(max, latencyUs)) {
+	}
+}
+
+void BusyPoller::Tick() {
+	uint64_t now = nowUs();
+	bool paused = paused_.load(std::memory_order_relaxed);
+	uint64_t spinTime = 0, parkTime = 0;
+	for (int i = 0, used = used_.load(); i < used; i++) {
+		Slot &s = slots_[i];
+		(s.spinning.load(std::memory_order_relaxed) ? spinTime : parkTime) += now - lastTick_;
+		// Loop may serve request concurrently. Then it's parked too early, and is woken up by the next one
+		uint64_t last = s.lastActivity.load(std::memory_order_relaxed);
+		switchTo(s, !paused && now < last + window(s.gapEwma.load(std::memory_order_relaxed)));
+	}
+	spinTime_ += spinTime;
+	parkTime_ += parkTime;
+	lastTick_ = now;
+}
+
+void BusyPoller::switchTo(Slot &s, bool spinning) {
+	if (s.spinning.load(std::memory_order_relaxed) == spinning || s.spinning.exchange(spinning) == spinning) return;
+	(spinning ? spins_ : parks_)++;
+}
+
+void BusyPoller::parkAll() {
+	for (int i = 0, used = used_.load(); i < used; i++) switchTo(slots_[i], false);
+}
+
+BusyPoller::Stats BusyPoller::TakeStats() {
+	Stats stats;
+	stats.spins = spins_.exchange(0);
+	stats.parks = parks_.exchange(0);
+	stats.wakeups = wakeups_.exchange(0);
+	stats.spinTimeUs = spinTime_.exchange(0);
+	stats.parkTimeUs = parkTime_.exchange(0);
+	stats.windowUs = stats.wakeLatencyMaxUs = 0;
+	uint64_t samples = 0, latencySum = 0;
+	// Loop is woken up by its first request before Activity, so wakeups are taken from all slots
+	for (int i = 0, used = used_.load(); i < kMaxThreads; i++) {
+		Slot &s = slots_[i];
+		if (i < used) stats.windowUs = std::max(stats.windowUs, window(s.gapEwma.load(std::memory_order_relaxed)));
+		if (!s.wakeSamples.load(std::memory_order_relaxed)) continue;
+		samples += s.wakeSamples.exchange(0);
+		latencySum += s.wakeLatencySum.exchange(0);
+		stats.wakeLatencyMaxUs = std::max(stats.wakeLatencyMaxUs, s.wakeLatencyMax.exchange(0));
+	}
+	stats.wakeLatencyUs = samples ? latencySum / samples : 0;
+	return stats;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "epoch.h"
+
+// Adaptive control of busy polling of event loops.
+// Loops are spinning only while requests are coming: after the last request they keep spinning for
+// a window, which is tuned to the recent gap between requests, and then park in blocking epoll_wait.
+// While background maintenance is running loops are parked, so they don't compete with it for cores.
+//
+// Each loop has own window and switch in own slot, found by ThreadIndex of loop thread. Loop writes only
+// its slot on request, and controller thread aggregates slots on tick, so loops don't share cache lines.
+class BusyPoller {
+public:
+	struct Stats {
+		uint64_t spins, parks, wakeups;
+		// Time of all loops, which have served requests
+		uint64_t spinTimeUs, parkTimeUs;
+		// Widest window of loops
+		uint64_t windowUs;
+		// Time from arrival of request to its read by parked loop, which it has woken up
+		uint64_t wakeLatencyUs, wakeLatencyMaxUs;
+	};
+
+	// Background work scope: loops are parked until it's finished
+	class Pause {
+	public:
+		Pause(BusyPoller &poller) : poller_(poller) {
+			poller_.paused_++;
+			poller_.parkAll();
+		}
+		~Pause() { poller_.paused_--; }
+
+	protected:
+		BusyPoller &poller_;
+	};
+
+	BusyPoller();
+	BusyPoller(const BusyPoller &) = delete;
+	BusyPoller &operator=(const BusyPoller &) = delete;
+
+	// Called by loop on each request
+	void Activity();
+	// Called by loop, which was parked, with latency of its wakeup by request
+	void Wakeup(uint64_t latencyUs);
+	// Called periodically by controller thread. Switches loops between spinning and parking
+	void Tick();
+	// Returns stats, accumulated since previous call
+	Stats TakeStats();
+	// Polled by loop before each epoll_wait
+	bool Spinning() const { return slots_[ThreadIndex()].spinning.load(std::memory_order_relaxed); }
+
+protected:
+	// State of loop. Activity fields are written only by loop, spinning also by controller on switch,
+	// and wakeup stats are taken by controller
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> lastActivity, gapEwma;
+		std::atomic<uint64_t> wakeSamples, wakeLatencySum, wakeLatencyMax;
+		std::atomic<bool> spinning;
+		bool used;
+	};
+
+	void switchTo(Slot &s, bool spinning);
+	void parkAll();
+
+	Slot slots_[kMaxThreads];
+	// Slots below are used by loops, which have served requests
+	alignas(64) std::atomic<int> used_;
+	std::atomic<int> paused_;
+	// Written on switches only
+	alignas(64) std::atomic<uint64_t> spins_, parks_, wakeups_;
+	// Written by controller thread
+	alignas(64) std::atomic<uint64_t> spinTime_, parkTime_;
+	uint64_t lastTick_;
+};
@@ -0,0 +1,93 @@
+#include "dictionary.h"
+#include <string>
+#include "json_schema.h"
+
+static const uint32_t kInitialTableSize = 1 << 12;
+
+StringDict::Table::Table(uint32_t size) : mask(size - 1), slots(new std::atomic<uint32_t>[size]) {
+	for (uint32_t i = 0; i < size; i++) slots[i].store(0, std::memory_order_relaxed);
+}
+
+StringDict::StringDict() : size_(0) {
+	for (auto &p : pages_) p.store(nullptr, std::memory_order_relaxed);
+	tables_.emplace_back(new Table(kInitialTableSize));
+	table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+StringDict::~StringDict() {
+	for (auto &p : pages_) delete[] p.load(std::memory_order_relaxed);
+}
+
+uint32_t StringDict::hash(const char *s, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) h = (h ^ uint8_t(s[i])) * 16777619u;
+	return h;
+}
+
+uint32_t StringDict::Find(const char *s, size_t len) const {
+	const Table *t = table_.load(std::memory_order_acquire);
+	for (uint32_t i = hash(s, len) & t->mask;; i = (i + 1) & t->mask) {
+		uint32_t slot = t->slots[i].load(std::memory_order_acquire);
+		if (!slot) return kNotFound;
+		const Entry &e = Get(slot - 1);
+		if (e.len == len && !memcmp(e.str, s, len)) return slot - 1;
+	}
+}
+
+void StringDict::insert(Table &table, uint32_t code) {
+	const Entry &e = Get(code);
+	uint32_t i = hash(e.str, e.len) & table.mask;
+	while (table.slots[i].load(std::memory_order_relaxed)) i = (i + 1) & table.mask;
+	table.slots[i].store(code + 1, std::memory_order_release);
+}
+
+uint32_t StringDict::Put(const char *s) {
+	if (!s) s = "";
+	size_t len = strlen(s);
+	std::lock_guard<std::mutex> lock(mtx_);
+	uint32_t code = Find(s, len);
+	if (code != kNotFound) return code;
+
+	code = size_.load(std::memory_order_relaxed);
+	if (code >= uint32_t(kMaxPages * kPageSize)) return kNotFound;
+	Entry *page = pages_[code >> kPageBits].load(std::memory_order_relaxed);
+	if (!page) {
+		page = new Entry[kPageSize];
+		pages_[code >> kPageBits].store(page, std::memory_order_release);
+	}
+
+	// Most of strings need no escaping, then json form is the string itself
+	Entry &e = page[code & (kPageSize - 1)];
+	e.str = strings_.Put(s, len);
+	e.len = len;
+	// Multibyte utf-8 is kept as is
+	size_t jsonLen = jsonschema::EscapedLen(s, len);
+	if (jsonLen == len) {
+		e.json = e.str;
+	} else {
+		std::string json(jsonLen, 0);
+		jsonschema::PutEscaped(&json[0], s, len);
+		e.json = strings_.Put(json.data(), jsonLen);
+	}
+	e.jsonLen = jsonLen;
+	size_.store(code + 1, std::memory_order_release);
+
+	// Load factor is kept below 1/2, so probe sequences are short
+	Table *t = table_.load(std::memory_order_relaxed);
+	if (2 * (code + 1) > t->mask + 1) {
+		tables_.emplace_back(new Table(2 * (t->mask + 1)));
+		t = tables_.back().get();
+		for (uint32_t c = 0; c < code; c++) insert(*t, c);
+	}
+	insert(*t, code);
+	table_.store(t, std::memory_order_release);
+	return code;
+}
+
+size_t StringDict::MemUsage() const {
+	std::lock_guard<std::mutex> lock(mtx_);
+	size_t sz = sizeof(*this) + strings_.Size();
+	for (auto &p : pages_) sz += p.load(std::memory_order_relaxed) ? kPageSize * sizeof(Entry) : 0;
+	for (auto &t : tables_) sz += (t->mask + 1) * sizeof(uint32_t);
+	return sz;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "string_arena.h"
+
+// Dictionary of low cardinality strings (gender, names, place, city, country), shared by all columns.
+// Each distinct string gets a dense code, which is never reused, and strings are never freed:
+// so codes and spans stay valid forever, and readers need no locks. Writers are serialized inside.
+class StringDict {
+public:
+	static const uint32_t kNotFound = UINT32_MAX;
+
+	// String and its json escaped form without quotes. Both are zero terminated
+	struct Entry {
+		const char *str;
+		const char *json;
+		uint32_t len;
+		uint32_t jsonLen;
+	};
+
+	StringDict();
+	~StringDict();
+	StringDict(const StringDict &) = delete;
+	StringDict &operator=(const StringDict &) = delete;
+
+	// Returns code of string, adding it if it's new. Null is the same as empty string
+	uint32_t Put(const char *s);
+	// Returns code of string or kNotFound
+	uint32_t Find(const char *s, size_t len) const;
+	uint32_t Find(const char *s) const { return Find(s, strlen(s)); }
+
+	const Entry &Get(uint32_t code) const { return pages_[code >> kPageBits].load(std::memory_order_acquire)[code & (kPageSize - 1)]; }
+	const char *Str(uint32_t code) const { return Get(code).str; }
+	const char *JSON(uint32_t code) const { return Get(code).json; }
+
+	size_t Size() const { return size_.load(std::memory_order_acquire); }
+	size_t MemUsage() const;
+
+protected:
+	static const int kPageBits = 12;
+	static const int kPageSize = 1 << kPageBits;
+	static const int kMaxPages = 1 << 10;
+
+	// Open addressing hash table of code + 1, 0 is empty slot. Table is replaced by twice bigger one
+	// on growth, and old tables are kept until destruction, because readers may still probe them
+	struct Table {
+		uint32_t mask;
+		std::unique_ptr<std::atomic<uint32_t>[]> slots;
+		explicit Table(uint32_t size);
+	};
+
+	static uint32_t hash(const char *s, size_t len);
+	void insert(Table &table, uint32_t code);
+
+	std::atomic<Entry *> pages_[kMaxPages];
+	std::atomic<Table *> table_;
+	std::vector<std::unique_ptr<Table>> tables_;
+	std::atomic<size_t> size_;
+	StringArena strings_;
+	mutable std::mutex mtx_;
+};
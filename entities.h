@@ -0,0 +1,30 @@
+#pragma once
+
+// Plain records of the three hlcup entities. String fields are not owned by
+// the record: they point into memory of whoever produced it (mapped data file,
+// request body, string arena).
+
+struct User {
+	int id;
+	int birth_date;
+	const char *gender;
+	const char *first_name;
+	const char *last_name;
+	const char *email;
+};
+
+struct Location {
+	int id;
+	int distance;
+	const char *place;
+	const char *city;
+	const char *country;
+};
+
+struct Visit {
+	int id;
+	int user;
+	int location;
+	int visited_at;
+	int mark;
+};
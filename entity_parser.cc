@@ -0,0 +1,310 @@
+
+#include "entity_parser.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum FieldType { FieldInt, FieldString };
+
+struct Field {
+	const char *name;
+	size_t len;
+	FieldType type;
+	size_t offset;
+};
+
+#define FIELD(rec, name, type) \
+	{ #name, sizeof(#name) - 1, type, offsetof(rec, name) }
+
+// Field slot is found by hash of key length and first char, which is perfect for each of the schemas.
+// Duplicated case labels don't compile, so perfectness is checked at compile time
+constexpr unsigned fieldHash(const char *s, size_t len) { return (len + static_cast<unsigned char>(s[0])) & 15; }
+template <size_t N>
+constexpr unsigned fieldHash(const char (&s)[N]) {
+	return fieldHash(s, N - 1);
+}
+
+// Case values are indexes in the field tables
+static const Field userFields[] = {
+	FIELD(User, id, FieldInt),
+	FIELD(User, birth_date, FieldInt),
+	FIELD(User, gender, FieldString),
+	FIELD(User, first_name, FieldString),
+	FIELD(User, last_name, FieldString),
+	FIELD(User, email, FieldString),
+};
+
+static int userField(const char *key, size_t len) {
+	switch (fieldHash(key, len)) {
+		case fieldHash("id"):
+			return 0;
+		case fieldHash("birth_date"):
+			return 1;
+		case fieldHash("gender"):
+			return 2;
+		case fieldHash("first_name"):
+			return 3;
+		case fieldHash("last_name"):
+			return 4;
+		case fieldHash("email"):
+			return 5;
+	}
+	return -1;
+}
+
+static const Field locationFields[] = {
+	FIELD(Location, id, FieldInt),
+	FIELD(Location, distance, FieldInt),
+	FIELD(Location, place, FieldString),
+	FIELD(Location, city, FieldString),
+	FIELD(Location, country, FieldString),
+};
+
+static int locationField(const char *key, size_t len) {
+	switch (fieldHash(key, len)) {
+		case fieldHash("id"):
+			return 0;
+		case fieldHash("distance"):
+			return 1;
+		case fieldHash("place"):
+			return 2;
+		case fieldHash("city"):
+			return 3;
+		case fieldHash("country"):
+			return 4;
+	}
+	return -1;
+}
+
+static const Field visitFields[] = {
+	FIELD(Visit, id, FieldInt),
+	FIELD(Visit, user, FieldInt),
+	FIELD(Visit, location, FieldInt),
+	FIELD(Visit, visited_at, FieldInt),
+	FIELD(Visit, mark, FieldInt),
+};
+
+static int visitField(const char *key, size_t len) {
+	switch (fieldHash(key, len)) {
+		case fieldHash("id"):
+			return 0;
+		case fieldHash("user"):
+			return 1;
+		case fieldHash("location"):
+			return 2;
+		case fieldHash("visited_at"):
+			return 3;
+		case fieldHash("mark"):
+			return 4;
+	}
+	return -1;
+}
+
+static void skipWS(char *&p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+}
+
+static bool parseHex4(char *&p, const char *end, unsigned &cp) {
+	if (end - p < 4) return false;
+	cp = 0;
+	for (int i = 0; i < 4; i++, p++) {
+		char c = *p;
+		if (c >= '0' && c <= '9') {
+			cp = cp * 16 + (c - '0');
+		} else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+			cp = cp * 16 + ((c | 0x20) - 'a' + 10);
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+static char *putUtf8(char *w, unsigned cp) {
+	if (cp < 0x80) {
+		*w++ = cp;
+	} else if (cp < 0x800) {
+		*w++ = 0xC0 | (cp >> 6);
+		*w++ = 0x80 | (cp & 0x3F);
+	} else if (cp < 0x10000) {
+		*w++ = 0xE0 | (cp >> 12);
+		*w++ = 0x80 | ((cp >> 6) & 0x3F);
+		*w++ = 0x80 | (cp & 0x3F);
+	} else {
+		*w++ = 0xF0 | (cp >> 18);
+		*w++ = 0x80 | ((cp >> 12) & 0x3F);
+		*w++ = 0x80 | ((cp >> 6) & 0x3F);
+		*w++ = 0x80 | (cp & 0x3F);
+	}
+	return w;
+}
+
+// Unescapes string in place. Decoded string is never longer than escaped one,
+// so it is terminated by zero at most at the position of closing quote
+static bool parseString(char *&pos, const char *end, char *&str, size_t &len) {
+	// Local cursor: stores through char pointers could alias the referenced one
+	char *p = pos + 1;
+	str = p;
+	// Until the first escape string is already in place, so just scan it
+	while (p < end && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20) p++;
+	char *w = p;
+	while (p < end) {
+		char c = *p++;
+		if (c == '"') {
+			len = w - str;
+			*w = 0;
+			pos = p;
+			return true;
+		}
+		if (static_cast<unsigned char>(c) < 0x20) return false;
+		if (c != '\\') {
+			*w++ = c;
+			continue;
+		}
+		if (p >= end) return false;
+		switch (*p++) {
+			case '"':
+				*w++ = '"';
+				break;
+			case '\\':
+				*w++ = '\\';
+				break;
+			case '/':
+				*w++ = '/';
+				break;
+			case 'b':
+				*w++ = '\b';
+				break;
+			case 'f':
+				*w++ = '\f';
+				break;
+			case 'n':
+				*w++ = '\n';
+				break;
+			case 'r':
+				*w++ = '\r';
+				break;
+			case 't':
+				*w++ = '\t';
+				break;
+			case 'u': {
+				unsigned cp;
+				if (!parseHex4(p, end, cp)) return false;
+				if (cp >= 0xD800 && cp < 0xDC00) {
+					unsigned lo;
+					if (end - p < 2 || p[0] != '\\' || p[1] != 'u') return false;
+					p += 2;
+					if (!parseHex4(p, end, lo) || lo < 0xDC00 || lo > 0xDFFF) return false;
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				}
+				w = putUtf8(w, cp);
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	return false;
+}
+
+static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+static bool parseInt(char *&p, const char *end, int &val) {
+	char *beg = p;
+	bool neg = p < end && *p == '-';
+	if (neg) p++;
+	if (p >= end || !isDigit(*p)) return false;
+
+	int64_t v = 0;
+	for (int digits = 0; p < end && isDigit(*p); p++, digits++) {
+		if (digits == 18) return false;
+		v = v * 10 + (*p - '0');
+	}
+	if (p < end && (*p == '.' || *p == 'e' || *p == 'E')) {
+		// Rare case of non integer number. Buffer is terminated by non number char, so strtod stops inside it
+		char *pend = nullptr;
+		double d = strtod(beg, &pend);
+		if (pend > end) return false;
+		p = pend;
+		val = int(d);
+		return true;
+	}
+	val = int(neg ? -v : v);
+	return true;
+}
+
+// Values of unknown keys are skipped. Objects are flat, so only scalars are expected there
+static bool skipScalar(char *&p, const char *end) {
+	if (*p == '"') {
+		char *str;
+		size_t len;
+		return parseString(p, end, str, len);
+	}
+	char *beg = p;
+	while (p < end && (isDigit(*p) || (*p >= 'a' && *p <= 'z') || *p == '-' || *p == '+' || *p == '.' || *p == 'E')) p++;
+	return p > beg;
+}
+
+static bool parseObject(char *&pos, const char *end, void *rec, const Field *fields, int (*lookup)(const char *, size_t),
+						unsigned &present) {
+	char *p = pos;
+	present = 0;
+	skipWS(p, end);
+	if (p >= end || *p != '{') return false;
+	p++;
+	skipWS(p, end);
+	if (p < end && *p == '}') {
+		pos = p + 1;
+		return true;
+	}
+
+	for (;;) {
+		char *key;
+		size_t keyLen;
+		skipWS(p, end);
+		if (p >= end || *p != '"' || !parseString(p, end, key, keyLen)) return false;
+		skipWS(p, end);
+		if (p >= end || *p != ':') return false;
+		p++;
+		skipWS(p, end);
+		if (p >= end) return false;
+
+		int idx = lookup(key, keyLen);
+		if (idx >= 0 && (fields[idx].len != keyLen || memcmp(fields[idx].name, key, keyLen))) idx = -1;
+
+		if (idx < 0) {
+			if (!skipScalar(p, end)) return false;
+		} else {
+			char *dst = static_cast<char *>(rec) + fields[idx].offset;
+			if (fields[idx].type == FieldInt) {
+				int val;
+				if (!parseInt(p, end, val)) return false;
+				memcpy(dst, &val, sizeof(val));
+			} else {
+				char *str;
+				size_t len;
+				if (*p != '"' || !parseString(p, end, str, len)) return false;
+				const char *cstr = str;
+				memcpy(dst, &cstr, sizeof(cstr));
+			}
+			present |= 1u << idx;
+		}
+
+		skipWS(p, end);
+		if (p >= end) return false;
+		if (*p == '}') {
+			pos = p + 1;
+			return true;
+		}
+		if (*p++ != ',') return false;
+	}
+}
+
+bool ParseUser(char *&p, const char *end, User &u, unsigned &fields) { return parseObject(p, end, &u, userFields, userField, fields); }
+
+bool ParseLocation(char *&p, const char *end, Location &l, unsigned &fields) {
+	return parseObject(p, end, &l, locationFields, locationField, fields);
+}
+
+bool ParseVisit(char *&p, const char *end, Visit &v, unsigned &fields) { return parseObject(p, end, &v, visitFields, visitField, fields); }
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "entities.h"
+
+// Schema aware parser of flat json objects of known entities.
+// It does not allocate: strings are unescaped in place and records are pointing to them.
+// Parsed object is applied to the record, fields missing in json are kept as is.
+// Returns false on malformed json, null or wrongly typed value of known field.
+// On success p points after the closing brace, and `fields` has bits of the fields present in json
+bool ParseUser(char *&p, const char *end, User &u, unsigned &fields);
+bool ParseLocation(char *&p, const char *end, Location &l, unsigned &fields);
+bool ParseVisit(char *&p, const char *end, Visit &v, unsigned &fields);
+
+// Masks of all fields of entity
+const unsigned kUserFields = 0x3F;
+const unsigned kLocationFields = 0x1F;
+const unsigned kVisitFields = 0x1F;
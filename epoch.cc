@@ -0,0 +1,126 @@
+#include "epoch.h"
+#include <stdlib.h>
+
+static std::atomic<bool> usedIndexes[kMaxThreads];
+
+// Index is released on exit of thread
+struct ThreadSlot {
+	int index = -1;
+	~ThreadSlot() {
+		if (index >= 0) usedIndexes[index].store(false, std::memory_order_release);
+	}
+};
+static thread_local ThreadSlot tlsSlot;
+
+int ThreadIndex() {
+	if (tlsSlot.index >= 0) return tlsSlot.index;
+	for (int i = 0; i < kMaxThreads; i++) {
+		bool expected = false;
+		if (!usedIndexes[i].load(std::memory_order_relaxed) && usedIndexes[i].compare_exchange_strong(expected, true)) {
+			return tlsSlot.index = i;
+		}
+	}
+	abort();
+}
+
+// Epoch 0 marks free slot, so epochs are counted from 1
+EpochManager::EpochManager() : epoch_(1) {
+	for (auto &s : slots_) s.epoch.store(0, std::memory_order_relaxed);
+	for (auto &r : rings_) r.store(nullptr, std::memory_order_relaxed);
+}
+
+EpochManager::~EpochManager() {
+	for (auto &r : rings_) {
+		Ring *ring = r.load(std::memory_order_acquire);
+		if (!ring) continue;
+		collect(*ring, UINT64_MAX);
+		free(ring);
+	}
+	for (auto &r : overflow_) r.deleter(r.ptr);
+}
+
+EpochManager::Guard::Guard(EpochManager &em) : slot_(em.slots_[ThreadIndex()].epoch) {
+	// Collector may advance epoch and scan slots before pin is visible. Then it's repeated with the new epoch,
+	// so collector either sees the pin, or pinned epoch is newer than any memory it frees
+	uint64_t epoch = em.epoch_.load();
+	for (;;) {
+		slot_.store(epoch, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint64_t cur = em.epoch_.load();
+		if (cur == epoch) break;
+		epoch = cur;
+	}
+}
+
+void EpochManager::Retire(void *p, Deleter deleter) {
+	// Memory is unlinked before its epoch is read: reader, which is pinned at later epoch, can't reach it
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	Retired r{p, deleter, epoch_.load()};
+
+	auto &slot = rings_[ThreadIndex()];
+	Ring *ring = slot.load(std::memory_order_acquire);
+	if (!ring) {
+		// Ring is POD, and heads of producer and consumer must be on separate cache lines
+		void *mem = nullptr;
+		if (posix_memalign(&mem, alignof(Ring), sizeof(Ring))) abort();
+		ring = static_cast<Ring *>(mem);
+		ring->head.store(0, std::memory_order_relaxed);
+		ring->tail.store(0, std::memory_order_relaxed);
+		slot.store(ring, std::memory_order_release);
+	}
+	uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+	if (tail - ring->head.load(std::memory_order_acquire) < Ring::kSize) {
+		ring->items[tail % Ring::kSize] = r;
+		ring->tail.store(tail + 1, std::memory_order_release);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(overflowMtx_);
+	overflow_.push_back(r);
+}
+
+// Epochs of ring are non decreasing: they are read by the same thread one after another
+void EpochManager::collect(Ring &ring, uint64_t epoch) {
+	uint64_t head = ring.head.load(std::memory_order_relaxed), tail = ring.tail.load(std::memory_order_acquire);
+	for (; head != tail; head++) {
+		Retired &r = ring.items[head % Ring::kSize];
+		if (r.epoch >= epoch) break;
+		r.deleter(r.ptr);
+	}
+	ring.head.store(head, std::memory_order_release);
+}
+
+void EpochManager::Collect() {
+	uint64_t minPinned = epoch_.fetch_add(1) + 1;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	for (auto &s : slots_) {
+		uint64_t epoch = s.epoch.load(std::memory_order_acquire);
+		if (epoch && epoch < minPinned) minPinned = epoch;
+	}
+
+	for (auto &r : rings_) {
+		Ring *ring = r.load(std::memory_order_acquire);
+		if (ring) collect(*ring, minPinned);
+	}
+
+	// Overflow is not ordered by epoch, because it's filled by many threads
+	std::lock_guard<std::mutex> lock(overflowMtx_);
+	size_t kept = 0;
+	for (auto &r : overflow_) {
+		if (r.epoch < minPinned) {
+			r.deleter(r.ptr);
+		} else {
+			overflow_[kept++] = r;
+		}
+	}
+	overflow_.resize(kept);
+}
+
+size_t EpochManager::Pending() const {
+	size_t pending = 0;
+	for (auto &r : rings_) {
+		Ring *ring = r.load(std::memory_order_acquire);
+		if (ring) pending += ring->tail.load(std::memory_order_acquire) - ring->head.load(std::memory_order_acquire);
+	}
+	std::lock_guard<std::mutex> lock(overflowMtx_);
+	return pending + overflow_.size();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+static const int kMaxThreads = 256;
+
+// Small dense index of calling thread, unique among live threads. Index of exited thread is reused
+int ThreadIndex();
+
+// Epoch based reclamation of memory, which writers replace while lock free readers may still use it.
+// Reader pins current epoch in own slot for the time of request: it's a store and a fence, without locks
+// or writes to shared cache lines. Memory retired in an epoch is freed when no reader is pinned at or before it.
+class EpochManager {
+public:
+	// Pins epoch for the scope. Guards of the same thread must not nest
+	class Guard {
+	public:
+		explicit Guard(EpochManager &em);
+		~Guard() { slot_.store(0, std::memory_order_release); }
+		Guard(const Guard &) = delete;
+		Guard &operator=(const Guard &) = delete;
+
+	protected:
+		std::atomic<uint64_t> &slot_;
+	};
+
+	EpochManager();
+	~EpochManager();
+	EpochManager(const EpochManager &) = delete;
+	EpochManager &operator=(const EpochManager &) = delete;
+
+	typedef void (*Deleter)(void *);
+
+	// Schedules deleter of memory, which is already unreachable for new readers. Retire takes no locks,
+	// unless retired list of thread overflows, which may happen only if collector is stalled
+	void Retire(void *p, Deleter deleter = free);
+	// Advances epoch and frees memory, which can't be used by pinned readers. Called periodically by one thread
+	void Collect();
+	// Number of retired blocks, which are not freed yet
+	size_t Pending() const;
+
+protected:
+	// Epoch of pinned reader, 0 if thread is not pinned
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> epoch;
+	};
+	struct Retired {
+		void *ptr;
+		Deleter deleter;
+		uint64_t epoch;
+	};
+	// Retired memory of thread. Ring has one producer, thread itself, and one consumer, collector
+	struct Ring {
+		static const size_t kSize = 4096;
+		alignas(64) std::atomic<uint64_t> head;
+		alignas(64) std::atomic<uint64_t> tail;
+		Retired items[kSize];
+	};
+	// Frees retired entries of ring, which are older than epoch
+	static void collect(Ring &ring, uint64_t epoch);
+
+	alignas(64) std::atomic<uint64_t> epoch_;
+	Slot slots_[kMaxThreads];
+	// Rings are allocated on first Retire of thread
+	std::atomic<Ring *> rings_[kMaxThreads];
+	// Entries, which didn't fit in ring
+	mutable std::mutex overflowMtx_;
+	std::deque<Retired> overflow_;
+};
@@ -0,0 +1,41 @@
+
+#include "histogram.h"
+#include <algorithm>
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+	for (int i = 0; i < kBuckets; i++) {
+		uint64_t n = other.buckets_[i].load(std::memory_order_relaxed);
+		if (n) buckets_[i].fetch_add(n, std::memory_order_relaxed);
+	}
+	count_.fetch_add(other.count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	uint64_t otherMax = other.Max(), max = Max();
+	while (otherMax > max && !max_.compare_exchange_weak(max, otherMax, std::memory_order_relaxed)) {
+	}
+}
+
+void LatencyHistogram::Reset() {
+	for (auto &b : buckets_) b.store(0, std::memory_order_relaxed);
+	count_.store(0, std::memory_order_relaxed);
+	sum_.store(0, std::memory_order_relaxed);
+	max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::upperBound(int bucket) {
+	if (bucket < kExact) return bucket;
+	int shift = (bucket - kExact) / kSubBuckets + 1;
+	uint64_t sub = (bucket - kExact) % kSubBuckets + kSubBuckets;
+	return ((sub + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+	// Buckets are read while other threads may record, so result is approximate
+	uint64_t total = Count();
+	if (!total) return 0;
+	uint64_t rank = std::max(uint64_t(1), uint64_t(p / 100. * total + 0.5)), seen = 0;
+	for (int i = 0; i < kBuckets; i++) {
+		seen += buckets_[i].load(std::memory_order_relaxed);
+		if (seen >= rank) return std::min(upperBound(i), Max());
+	}
+	return Max();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// HDR style latency histogram with log-linear buckets: values below 64 are exact,
+// and each next power of 2 range is split to 32 buckets, so relative error is under 3%.
+// Record is lock free and wait free, so histogram may be shared by threads.
+class LatencyHistogram {
+public:
+	LatencyHistogram() { Reset(); }
+	LatencyHistogram(const LatencyHistogram &) = delete;
+	LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+	void Record(uint64_t value) {
+		buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(value, std::memory_order_relaxed);
+		uint64_t max = max_.load(std::memory_order_relaxed);
+		while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+		}
+	}
+	void Merge(const LatencyHistogram &other);
+	void Reset();
+
+	uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+	double Mean() const { return Count() ? double(sum_.load(std::memory_order_relaxed)) / Count() : 0; }
+	// Value at percentile p (0..100): upper bound of bucket, clamped by max
+	uint64_t Percentile(double p) const;
+
+protected:
+	static const int kExact = 64;
+	static const int kSubBuckets = 32;
+	static const int kBuckets = kExact + kSubBuckets * 58;
+
+	static int bucket(uint64_t value) {
+		if (value < uint64_t(kExact)) return int(value);
+		int shift = 63 - __builtin_clzll(value) - 5;
+		return kExact + (shift - 1) * kSubBuckets + int(value >> shift) - kSubBuckets;
+	}
+	static uint64_t upperBound(int bucket);
+
+	std::atomic<uint64_t> buckets_[kBuckets];
+	std::atomic<uint64_t> count_, sum_, max_;
+};
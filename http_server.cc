@@ -0,0 +1,825 @@
+#include "http_server.h"
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace http {
+
+static const char kContentTypeJSON[] = "application/json; charset=utf-8";
+static const char kContentTypeText[] = "text/plain; charset=utf-8";
+
+// Read buffer grows up to the largest request with body
+static const size_t kReadBufSize = 16 << 10;
+static const size_t kMaxRequestSize = 1 << 20;
+// Read is not attempted into a smaller tail of buffer: the rest of partial request is moved to its start
+static const size_t kMinRead = 4 << 10;
+static const size_t kMaxHeadersSize = 64 << 10;
+// Output queue of connection, over which it's not read and not dispatched. Single response is not split,
+// because handler can't wait, so queue may exceed the limit by one response
+static const size_t kMaxOutput = 512 << 10;
+static const size_t kBlockSize = 16 << 10;
+// Free blocks kept by loop for reuse
+static const size_t kMaxFreeBlocks = 1024;
+static const int kMaxIov = 64;
+static const int kMaxEvents = 256;
+static const int kAcceptBatch = 64;
+
+// Counters are written by loop thread only, so increment is a plain load and store
+static inline void bump(std::atomic<uint64_t> &c) { c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+// Part of output queue of connection
+struct OutBlock {
+	OutBlock *next;
+	size_t len;
+	char *data() { return reinterpret_cast<char *>(this + 1); }
+};
+
+class Loop {
+public:
+	// Loop listens listenFd, and closes it, if it's not the socket of listener
+	Loop(Listener &listener, int index, int listenFd);
+	~Loop();
+
+	void Run();
+
+	OutBlock *AllocBlock();
+	void FreeBlock(OutBlock *b);
+	// Connection is reused after all events of current epoll_wait are handled
+	void Release(Connection *conn);
+
+	Listener &listener;
+	const int index;
+	const int listenFd;
+	int epfd;
+	// Events are handled after blocking epoll_wait, and wakeup latency is not measured yet
+	bool woken;
+
+	// Read by GetStats of other threads
+	struct Counters {
+		std::atomic<uint64_t> requests, reads, writes, accepts;
+	} counters;
+
+protected:
+	void accept();
+
+	std::vector<std::unique_ptr<Connection>> conns_;
+	std::vector<Connection *> idle_, released_;
+	std::vector<OutBlock *> freeBlocks_;
+};
+
+class Connection {
+public:
+	explicit Connection(Loop &loop);
+	~Connection();
+
+	bool Open(int fd);
+	void Handle(uint32_t events);
+	bool IsOpen() const { return fd_ >= 0; }
+	void Close();
+
+	// Output queue
+	void Append(const void *data, size_t len);
+	// Contiguous space for len <= kBlockSize bytes at the end of queue, which are queued by Commit
+	char *Reserve(size_t len);
+	void Commit(size_t len) {
+		tail_->len += len;
+		outBytes_ += len;
+	}
+
+protected:
+	friend class Writer;
+	bool paused() const { return outBytes_ >= kMaxOutput; }
+	bool read();
+	// Reads like read(2), and reports wakeup latency by receive timestamp of data
+	ssize_t readStamped(char *buf, size_t len);
+	bool process();
+	bool flush();
+	// Parses request at inPos_. Returns its length with body, 0 if it's incomplete, or http status of error
+	size_t parse(bool &keepAlive, bool &http10, int &error);
+	void parseParams(char *query);
+	void dispatch(bool keepAlive, bool http10);
+	void replyError(int status);
+	void updateEvents();
+
+	Loop &loop_;
+	int fd_;
+	uint32_t events_;
+	// Unparsed input is in [inPos_, inEnd_) of in_
+	std::unique_ptr<char[]> in_;
+	size_t inCap_, inPos_, inEnd_;
+	OutBlock *head_, *tail_;
+	// Bytes of head_, which are sent already
+	size_t headSent_, outBytes_;
+	// Close after output is sent: response closed connection, client closed its side, or socket failed
+	bool closing_, eof_, failed_;
+
+	Request req_;
+	Reader reader_;
+	Writer writer_;
+	Context ctx_;
+};
+
+// Unescapes %XX and '+' in place. Returns zero terminated string
+static char *urlDecode(char *s) {
+	char *out = s;
+	for (char *p = s; *p; p++) {
+		if (*p == '+') {
+			*out++ = ' ';
+		} else if (*p == '%' && isxdigit(uint8_t(p[1])) && isxdigit(uint8_t(p[2]))) {
+			char hex[3] = {p[1], p[2], 0};
+			*out++ = char(strtol(hex, nullptr, 16));
+			p += 2;
+		} else {
+			*out++ = *p;
+		}
+	}
+	*out = 0;
+	return s;
+}
+
+static char *appendStr(char *p, const char *s, size_t len) {
+	memcpy(p, s, len);
+	return p + len;
+}
+
+static char *appendUint(char *p, uint64_t v, int base = 10) {
+	char buf[24];
+	int n = 0;
+	do {
+		buf[n++] = "0123456789abcdef"[v % base];
+		v /= base;
+	} while (v);
+	while (n) *p++ = buf[--n];
+	return p;
+}
+
+static const char *reasonPhrase(int code) {
+	switch (code) {
+		case StatusOK:
+			return "OK";
+		case StatusBadRequest:
+			return "Bad Request";
+		case StatusNotFound:
+			return "Not Found";
+		case StatusRequestEntityTooLarge:
+			return "Request Entity Too Large";
+		case StatusInternalServerError:
+			return "Internal Server Error";
+		default:
+			return "Unknown";
+	}
+}
+
+ssize_t Reader::Read(void *buf, size_t size) {
+	size_t n = std::min(size, Pending());
+	memcpy(buf, pos_, n);
+	pos_ += n;
+	return n;
+}
+
+void Writer::reset(bool keepAlive, bool http10) {
+	contentType_ = kContentTypeJSON;
+	contentLength_ = -1;
+	written_ = bodyWritten_ = 0;
+	code_ = StatusOK;
+	headersSent_ = chunked_ = false;
+	close_ = !keepAlive;
+	http10_ = http10;
+}
+
+void Writer::writeHeaders() {
+	headersSent_ = true;
+	// HTTP/1.0 has no chunked encoding, so body of unknown length is delimited by close
+	if (contentLength_ < 0) {
+		chunked_ = !http10_;
+		close_ = close_ || http10_;
+	}
+
+	static const size_t kMaxHeaders = 256;
+	char *start = conn_.Reserve(kMaxHeaders), *p = start;
+	const char *reason = reasonPhrase(code_);
+	p = appendStr(p, "HTTP/1.1 ", 9);
+	p = appendUint(p, code_);
+	*p++ = ' ';
+	p = appendStr(p, reason, strlen(reason));
+	p = appendStr(p, "\r\nContent-Type: ", 16);
+	p = appendStr(p, contentType_, std::min(strlen(contentType_), size_t(100)));
+	if (chunked_) {
+		p = appendStr(p, "\r\nTransfer-Encoding: chunked", 28);
+	} else if (contentLength_ >= 0) {
+		p = appendStr(p, "\r\nContent-Length: ", 18);
+		p = appendUint(p, contentLength_);
+	}
+	// Keep-alive is default of HTTP/1.1
+	if (close_) {
+		p = appendStr(p, "\r\nConnection: close", 19);
+	} else if (http10_) {
+		p = appendStr(p, "\r\nConnection: keep-alive", 24);
+	}
+	p = appendStr(p, "\r\n\r\n", 4);
+	conn_.Commit(p - start);
+	written_ += p - start;
+}
+
+ssize_t Writer::Write(const void *buf, size_t size) {
+	if (!headersSent_) writeHeaders();
+	// Empty chunk would terminate body
+	if (!size) return 0;
+	if (chunked_) {
+		char hdr[24], *p = appendUint(hdr, size, 16);
+		p = appendStr(p, "\r\n", 2);
+		conn_.Append(hdr, p - hdr);
+		conn_.Append(buf, size);
+		conn_.Append("\r\n", 2);
+		written_ += (p - hdr) + size + 2;
+	} else {
+		conn_.Append(buf, size);
+		written_ += size;
+	}
+	bodyWritten_ += size;
+	return size;
+}
+
+// Append has tried to send queue over the limit, so it's still over the limit only if socket buffer is full
+bool Writer::Congested() const { return conn_.paused(); }
+
+bool Writer::finish() {
+	if (!headersSent_) {
+		if (contentLength_ < 0) contentLength_ = 0;
+		writeHeaders();
+	}
+	if (chunked_) {
+		conn_.Append("0\r\n\r\n", 5);
+		written_ += 5;
+	}
+	// Body of other length than declared would break framing of the next response
+	if (contentLength_ >= 0 && bodyWritten_ != size_t(contentLength_)) close_ = true;
+	return !close_;
+}
+
+int Context::JSON(int code, const void *data, size_t size) {
+	writer->SetRespCode(code);
+	writer->SetContentType(kContentTypeJSON);
+	writer->SetContentLength(size);
+	writer->Write(data, size);
+	return 0;
+}
+
+int Context::CString(int code, const char *str) {
+	size_t size = strlen(str);
+	writer->SetRespCode(code);
+	writer->SetContentType(kContentTypeText);
+	writer->SetContentLength(size);
+	writer->Write(str, size);
+	return 0;
+}
+
+void Router::add(const char *method, const char *path, void *object, Handler handler) {
+	size_t len = strlen(path);
+	routes_.push_back(Route{method, path, len, len && path[len - 1] == '/', object, handler});
+}
+
+bool Router::Handle(Context &ctx) const {
+	const char *path = ctx.request->path;
+	for (auto &r : routes_) {
+		if (strcmp(r.method, ctx.request->method)) continue;
+		if (r.prefix ? strncmp(path, r.path, r.len) : strcmp(path, r.path)) continue;
+		ctx.request->pathParams = path + r.len;
+		r.handler(r.object, ctx);
+		return true;
+	}
+	return false;
+}
+
+Connection::Connection(Loop &loop)
+	: loop_(loop),
+	  fd_(-1),
+	  events_(0),
+	  in_(new char[kReadBufSize]),
+	  inCap_(kReadBufSize),
+	  inPos_(0),
+	  inEnd_(0),
+	  head_(nullptr),
+	  tail_(nullptr),
+	  headSent_(0),
+	  outBytes_(0),
+	  closing_(false),
+	  eof_(false),
+	  failed_(false),
+	  writer_(*this) {
+	ctx_.request = &req_;
+	ctx_.writer = &writer_;
+	ctx_.body = &reader_;
+}
+
+Connection::~Connection() {
+	if (IsOpen()) Close();
+}
+
+bool Connection::Open(int fd) {
+	fd_ = fd;
+	events_ = EPOLLIN | EPOLLRDHUP;
+	epoll_event ev;
+	ev.events = events_;
+	ev.data.ptr = this;
+	if (epoll_ctl(loop_.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		::close(fd);
+		fd_ = -1;
+		return false;
+	}
+	return true;
+}
+
+void Connection::Close() {
+	// Closed fd is removed from epoll
+	::close(fd_);
+	fd_ = -1;
+	while (head_) {
+		OutBlock *next = head_->next;
+		loop_.FreeBlock(head_);
+		head_ = next;
+	}
+	tail_ = nullptr;
+	headSent_ = outBytes_ = 0;
+	inPos_ = inEnd_ = 0;
+	// Grown buffer is not kept by idle connection
+	if (inCap_ > kReadBufSize) {
+		in_.reset(new char[kReadBufSize]);
+		inCap_ = kReadBufSize;
+	}
+	closing_ = eof_ = failed_ = false;
+	loop_.Release(this);
+}
+
+void Connection::Handle(uint32_t events) {
+	bool ok = !(events & EPOLLERR);
+	if (ok && (events & EPOLLOUT)) ok = flush();
+	if (ok && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !closing_ && !eof_ && !paused()) ok = read();
+	// Requests, which are left in buffer while output was over the limit, are dispatched after it's drained
+	if (ok) ok = process();
+	if (!ok || failed_ || (closing_ && !outBytes_)) {
+		Close();
+		return;
+	}
+	updateEvents();
+}
+
+bool Connection::read() {
+	if (inPos_ == inEnd_) inPos_ = inEnd_ = 0;
+	if (inCap_ - inEnd_ < kMinRead && inPos_) {
+		memmove(in_.get(), in_.get() + inPos_, inEnd_ - inPos_);
+		inEnd_ -= inPos_;
+		inPos_ = 0;
+	}
+	if (inEnd_ == inCap_) {
+		// Buffer is taken by one partial request
+		if (inCap_ >= kMaxRequestSize) {
+			replyError(StatusRequestEntityTooLarge);
+			return true;
+		}
+		size_t cap = std::min(inCap_ * 2, kMaxRequestSize);
+		char *grown = new char[cap];
+		memcpy(grown, in_.get(), inEnd_);
+		in_.reset(grown);
+		inCap_ = cap;
+	}
+
+	ssize_t n = loop_.woken ? readStamped(in_.get() + inEnd_, inCap_ - inEnd_) : ::read(fd_, in_.get() + inEnd_, inCap_ - inEnd_);
+	bump(loop_.counters.reads);
+	if (n > 0) {
+		inEnd_ += n;
+		return true;
+	}
+	if (n == 0) {
+		// Client closed its side, but requests, which it has sent, are still answered
+		eof_ = true;
+		return true;
+	}
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+ssize_t Connection::readStamped(char *buf, size_t len) {
+	iovec iov{buf, len};
+	char control[CMSG_SPACE(sizeof(timespec))];
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t n = recvmsg(fd_, &msg, 0);
+	if (n <= 0) return n;
+
+	// Kernel stamps data by realtime clock on arrival
+	for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPNS) continue;
+		timespec arrived, now;
+		memcpy(&arrived, CMSG_DATA(c), sizeof(arrived));
+		clock_gettime(CLOCK_REALTIME, &now);
+		int64_t ns = int64_t(now.tv_sec - arrived.tv_sec) * 1000000000 + (now.tv_nsec - arrived.tv_nsec);
+		loop_.woken = false;
+		loop_.listener.wakeupLatency_(ns > 0 ? uint64_t(ns) / 1000 : 0);
+	}
+	return n;
+}
+
+bool Connection::process() {
+	while (!closing_ && !failed_ && !paused() && inPos_ < inEnd_) {
+		bool keepAlive, http10;
+		int error = 0;
+		size_t len = parse(keepAlive, http10, error);
+		if (error) {
+			replyError(error);
+			break;
+		}
+		if (!len) break;
+		dispatch(keepAlive, http10);
+		inPos_ += len;
+	}
+	// Complete requests may be left in buffer while output is over the limit, and they are answered after it's drained
+	if (eof_ && !paused()) closing_ = true;
+	return flush();
+}
+
+size_t Connection::parse(bool &keepAlive, bool &http10, int &error) {
+	char *start = in_.get() + inPos_, *end = in_.get() + inEnd_;
+	// Empty lines between requests are allowed
+	char *p = start;
+	while (p < end && (*p == '\r' || *p == '\n')) p++;
+	char *hdrEnd = static_cast<char *>(memmem(p, end - p, "\r\n\r\n", 4));
+	if (!hdrEnd) {
+		if (size_t(end - p) > kMaxHeadersSize) error = StatusBadRequest;
+		return 0;
+	}
+
+	// Request line. Strings are terminated in place only after request is complete
+	char *lineEnd = static_cast<char *>(memmem(p, hdrEnd + 2 - p, "\r\n", 2));
+	char *sp1 = static_cast<char *>(memchr(p, ' ', lineEnd - p));
+	char *sp2 = sp1 ? static_cast<char *>(memchr(sp1 + 1, ' ', lineEnd - sp1 - 1)) : nullptr;
+	if (!sp2 || lineEnd - sp2 - 1 != 8 || memcmp(sp2 + 1, "HTTP/1.", 7)) {
+		error = StatusBadRequest;
+		return 0;
+	}
+	http10 = sp2[8] == '0';
+	keepAlive = !http10;
+
+	size_t contentLength = 0;
+	for (char *line = lineEnd + 2; line < hdrEnd;) {
+		char *eol = static_cast<char *>(memmem(line, hdrEnd + 2 - line, "\r\n", 2));
+		char *colon = static_cast<char *>(memchr(line, ':', eol - line));
+		if (!colon) {
+			error = StatusBadRequest;
+			return 0;
+		}
+		char *val = colon + 1;
+		while (val < eol && (*val == ' ' || *val == '\t')) val++;
+		size_t nameLen = colon - line, valLen = eol - val;
+		if (nameLen == 14 && !strncasecmp(line, "Content-Length", 14)) {
+			char *num = val;
+			contentLength = 0;
+			for (; num < eol && *num >= '0' && *num <= '9' && contentLength <= kMaxRequestSize; num++) {
+				contentLength = contentLength * 10 + (*num - '0');
+			}
+			if (num == val || (num < eol && *num != ' ' && *num != '\t' && contentLength <= kMaxRequestSize)) {
+				error = StatusBadRequest;
+				return 0;
+			}
+		} else if (nameLen == 10 && !strncasecmp(line, "Connection", 10)) {
+			if (valLen >= 5 && !strncasecmp(val, "close", 5)) keepAlive = false;
+			if (valLen >= 10 && !strncasecmp(val, "keep-alive", 10)) keepAlive = true;
+		} else if (nameLen == 17 && !strncasecmp(line, "Transfer-Encoding", 17)) {
+			// Chunked bodies of requests are not supported
+			error = StatusBadRequest;
+			return 0;
+		}
+		line = eol + 2;
+	}
+
+	size_t len = (hdrEnd + 4 - start) + contentLength;
+	if (len > kMaxRequestSize) {
+		error = StatusRequestEntityTooLarge;
+		return 0;
+	}
+	if (len > size_t(end - start)) return 0;
+
+	*sp1 = 0;
+	*sp2 = 0;
+	char *query = static_cast<char *>(memchr(sp1 + 1, '?', sp2 - sp1 - 1));
+	if (query) *query++ = 0;
+	req_.method = p;
+	req_.path = sp1 + 1;
+	req_.pathParams = "";
+	parseParams(query);
+	reader_.pos_ = hdrEnd + 4;
+	reader_.end_ = reader_.pos_ + contentLength;
+	return len;
+}
+
+void Connection::parseParams(char *query) {
+	req_.params.clear();
+	for (char *s = query; s && *s;) {
+		char *amp = strchr(s, '&');
+		if (amp) *amp = 0;
+		if (*s) {
+			char *eq = strchr(s, '=');
+			if (eq) *eq = 0;
+			req_.params.push_back(Param{urlDecode(s), eq ? urlDecode(eq + 1) : ""});
+		}
+		s = amp ? amp + 1 : nullptr;
+	}
+}
+
+void Connection::dispatch(bool keepAlive, bool http10) {
+	writer_.reset(keepAlive, http10);
+	if (!loop_.listener.router_.Handle(ctx_)) ctx_.CString(StatusNotFound, "");
+	if (!writer_.finish()) closing_ = true;
+	bump(loop_.counters.requests);
+}
+
+void Connection::replyError(int status) {
+	writer_.reset(false, false);
+	ctx_.CString(status, "");
+	writer_.finish();
+	closing_ = true;
+}
+
+char *Connection::Reserve(size_t len) {
+	if (!tail_ || kBlockSize - tail_->len < len) {
+		OutBlock *b = loop_.AllocBlock();
+		if (tail_) {
+			tail_->next = b;
+		} else {
+			head_ = b;
+		}
+		tail_ = b;
+	}
+	return tail_->data() + tail_->len;
+}
+
+void Connection::Append(const void *data, size_t len) {
+	const char *p = static_cast<const char *>(data);
+	while (len) {
+		if (!tail_ || tail_->len == kBlockSize) Reserve(1);
+		size_t n = std::min(len, kBlockSize - tail_->len);
+		memcpy(tail_->data() + tail_->len, p, n);
+		Commit(n);
+		p += n;
+		len -= n;
+	}
+	// Large response is sent while handler is writing it, so queue does not grow far over the limit
+	if (paused() && !failed_ && !flush()) failed_ = true;
+}
+
+bool Connection::flush() {
+	while (outBytes_) {
+		iovec iov[kMaxIov];
+		int n = 0;
+		size_t total = 0;
+		for (OutBlock *b = head_; b && n < kMaxIov; b = b->next) {
+			size_t off = b == head_ ? headSent_ : 0;
+			iov[n].iov_base = b->data() + off;
+			iov[n].iov_len = b->len - off;
+			total += iov[n++].iov_len;
+		}
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		// Like writev, but without SIGPIPE on closed connection
+		ssize_t w = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+		bump(loop_.counters.writes);
+		if (w < 0) {
+			if (errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+
+		outBytes_ -= w;
+		for (size_t left = w; left;) {
+			size_t inHead = head_->len - headSent_;
+			if (left < inHead) {
+				headSent_ += left;
+				break;
+			}
+			left -= inHead;
+			OutBlock *next = head_->next;
+			loop_.FreeBlock(head_);
+			head_ = next;
+			headSent_ = 0;
+		}
+		if (!head_) tail_ = nullptr;
+		// Socket buffer is full, the rest is sent on EPOLLOUT
+		if (size_t(w) < total) break;
+	}
+	return true;
+}
+
+void Connection::updateEvents() {
+	uint32_t events = (closing_ || eof_ || paused() ? 0u : EPOLLIN | EPOLLRDHUP) | (outBytes_ ? EPOLLOUT : 0u);
+	if (events == events_) return;
+	events_ = events;
+	epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = this;
+	epoll_ctl(loop_.epfd, EPOLL_CTL_MOD, fd_, &ev);
+}
+
+Loop::Loop(Listener &l, int i, int fd) : listener(l), index(i), listenFd(fd), epfd(epoll_create1(EPOLL_CLOEXEC)), woken(false) {
+	counters.requests.store(0, std::memory_order_relaxed);
+	counters.reads.store(0, std::memory_order_relaxed);
+	counters.writes.store(0, std::memory_order_relaxed);
+	counters.accepts.store(0, std::memory_order_relaxed);
+
+	epoll_event ev;
+	// Shared listening socket wakes one of loops per connection with exclusive wakeup
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = nullptr;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev) < 0) {
+		ev.events = EPOLLIN;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev);
+	}
+	// Stop event is never read, so it wakes all loops
+	ev.events = EPOLLIN;
+	ev.data.ptr = this;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listener.stopFd_, &ev);
+}
+
+Loop::~Loop() {
+	for (auto &c : conns_) {
+		if (c->IsOpen()) c->Close();
+	}
+	conns_.clear();
+	for (auto b : freeBlocks_) free(b);
+	close(epfd);
+	if (listenFd != listener.listenFd_) close(listenFd);
+}
+
+OutBlock *Loop::AllocBlock() {
+	OutBlock *b;
+	if (!freeBlocks_.empty()) {
+		b = freeBlocks_.back();
+		freeBlocks_.pop_back();
+	} else {
+		b = static_cast<OutBlock *>(malloc(sizeof(OutBlock) + kBlockSize));
+	}
+	b->next = nullptr;
+	b->len = 0;
+	return b;
+}
+
+void Loop::FreeBlock(OutBlock *b) {
+	if (freeBlocks_.size() < kMaxFreeBlocks) {
+		freeBlocks_.push_back(b);
+	} else {
+		free(b);
+	}
+}
+
+void Loop::Release(Connection *conn) { released_.push_back(conn); }
+
+void Loop::accept() {
+	for (int i = 0; i < kAcceptBatch; i++) {
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		// Other loop may be faster
+		if (fd < 0) return;
+		bump(counters.accepts);
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (listener.wakeupLatency_) setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+
+		Connection *conn;
+		if (!idle_.empty()) {
+			conn = idle_.back();
+			idle_.pop_back();
+		} else {
+			conns_.emplace_back(new Connection(*this));
+			conn = conns_.back().get();
+		}
+		if (!conn->Open(fd)) idle_.push_back(conn);
+	}
+}
+
+void Loop::Run() {
+	if (listener.threadStart_) listener.threadStart_(index);
+	epoll_event events[kMaxEvents];
+	while (!listener.stopping_.load(std::memory_order_acquire)) {
+		bool spin = listener.busyPoll_ && listener.busyPoll_();
+		int n = epoll_wait(epfd, events, kMaxEvents, spin ? 0 : -1);
+		// Latency is measured by the first read of events, which have woken up parked loop
+		woken = !spin && n > 0 && listener.wakeupLatency_;
+		for (int i = 0; i < n; i++) {
+			void *ptr = events[i].data.ptr;
+			if (!ptr) {
+				accept();
+			} else if (ptr != this) {
+				// Connection, which was closed by previous event of the batch, is not reused yet
+				Connection *conn = static_cast<Connection *>(ptr);
+				if (conn->IsOpen()) conn->Handle(events[i].events);
+			}
+		}
+		idle_.insert(idle_.end(), released_.begin(), released_.end());
+		released_.clear();
+	}
+}
+
+Listener::Listener(Router &router)
+	: router_(router), reusePort_(false), listenFd_(-1), stopFd_(eventfd(0, EFD_CLOEXEC)), port_(0), stopping_(false) {}
+
+Listener::~Listener() {
+	Stop();
+	for (auto &t : threads_) t.join();
+	loops_.clear();
+	if (listenFd_ >= 0) close(listenFd_);
+	close(stopFd_);
+}
+
+// Returns listening socket or -1
+int Listener::listen(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (reusePort_ && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) reusePort_ = false;
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool Listener::Bind(int port) {
+	listenFd_ = listen(port);
+	if (listenFd_ < 0) return false;
+	sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	if (getsockname(listenFd_, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+		close(listenFd_);
+		listenFd_ = -1;
+		return false;
+	}
+	port_ = ntohs(addr.sin_port);
+	loops_.emplace_back(new Loop(*this, 0, listenFd_));
+	return true;
+}
+
+void Listener::Fork(int n) {
+	size_t first = loops_.size();
+	for (int i = 0; i < n; i++) {
+		// Loop, which can't get own socket, shares socket of Bind
+		int fd = reusePort_ ? listen(port_) : -1;
+		loops_.emplace_back(new Loop(*this, loops_.size(), fd >= 0 ? fd : listenFd_));
+	}
+	for (size_t i = first; i < loops_.size(); i++) {
+		Loop *loop = loops_[i].get();
+		threads_.emplace_back([loop]() { loop->Run(); });
+	}
+}
+
+int Listener::Sockets() const {
+	int n = 1;
+	for (auto &loop : loops_) n += loop->listenFd != listenFd_;
+	return n;
+}
+
+void Listener::Run() {
+	if (!loops_.empty()) loops_[0]->Run();
+	for (auto &t : threads_) t.join();
+	threads_.clear();
+}
+
+void Listener::Stop() {
+	stopping_.store(true, std::memory_order_release);
+	uint64_t one = 1;
+	if (write(stopFd_, &one, sizeof(one)) < 0) {
+		// Counter of eventfd can't overflow by a few writes
+	}
+}
+
+Listener::Stats Listener::GetStats() const {
+	Stats stats{0, 0, 0, 0};
+	for (auto &loop : loops_) {
+		stats.requests += loop->counters.requests.load(std::memory_order_relaxed);
+		stats.reads += loop->counters.reads.load(std::memory_order_relaxed);
+		stats.writes += loop->counters.writes.load(std::memory_order_relaxed);
+		stats.accepts += loop->counters.accepts.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+}  // namespace http
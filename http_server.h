@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// HTTP/1.1 server of GET and POST handlers with keep-alive and pipelining.
+// Each loop thread runs own epoll over connections, which it has accepted. All requests, which are complete
+// in read buffer of connection, are dispatched back to back, and their responses are collected in output
+// queue of connection and sent by one writev after the batch. Output queue is bounded: while it's over
+// the limit, connection is neither read nor dispatched, until client reads responses.
+namespace http {
+
+enum HttpStatusCode {
+	StatusOK = 200,
+	StatusBadRequest = 400,
+	StatusNotFound = 404,
+	StatusRequestEntityTooLarge = 413,
+	StatusInternalServerError = 500,
+};
+
+struct Param {
+	const char *name;
+	const char *val;
+};
+
+// Strings of request are in read buffer of connection, and are valid until handler returns
+struct Request {
+	const char *method;
+	const char *path;
+	// Rest of path after prefix of route
+	const char *pathParams;
+	// Decoded query parameters. Vector is reused by requests of connection
+	std::vector<Param> params;
+};
+
+class Connection;
+class Loop;
+
+// Body of request. Request is dispatched only after its body is received completely
+class Reader {
+public:
+	size_t Pending() const { return end_ - pos_; }
+	ssize_t Read(void *buf, size_t size);
+
+protected:
+	friend class Connection;
+	const char *pos_ = nullptr, *end_ = nullptr;
+};
+
+// Response. Status line and headers are queued with the first part of body, or after handler, if it has written
+// nothing. Body without content length is sent by chunks, one chunk per Write
+class Writer {
+public:
+	void SetRespCode(int code) { code_ = code; }
+	// Type must be a static string. Default is json
+	void SetContentType(const char *type) { contentType_ = type; }
+	void SetContentLength(size_t len) { contentLength_ = len; }
+	void SetConnectionClose() { close_ = true; }
+	ssize_t Write(const void *buf, size_t size);
+	// Output queue of connection is over its limit, because client does not read as fast as it's written.
+	// Handler of long response may stop and let client resume it by the next request
+	bool Congested() const;
+	int RespCode() const { return code_; }
+	// Bytes of response with headers
+	size_t Written() const { return written_; }
+
+protected:
+	friend class Connection;
+	explicit Writer(Connection &conn) : conn_(conn) {}
+	void reset(bool keepAlive, bool http10);
+	void writeHeaders();
+	// Completes response. Returns false, if connection must be closed after it
+	bool finish();
+
+	Connection &conn_;
+	const char *contentType_;
+	int64_t contentLength_;
+	size_t written_, bodyWritten_;
+	int code_;
+	bool headersSent_, chunked_, close_, http10_;
+};
+
+struct Context {
+	Request *request;
+	Writer *writer;
+	Reader *body;
+
+	int JSON(int code, const void *data, size_t size);
+	int CString(int code, const char *str);
+};
+
+// Routes by method and path. Path, which ends with '/', is a prefix, and the rest of request path is in pathParams
+class Router {
+public:
+	template <class K, int (K::*func)(Context &)>
+	void GET(const char *path, K *object) {
+		add("GET", path, object, &call<K, func>);
+	}
+	template <class K, int (K::*func)(Context &)>
+	void POST(const char *path, K *object) {
+		add("POST", path, object, &call<K, func>);
+	}
+
+	// Calls handler of request. Returns false, if there is no route for it
+	bool Handle(Context &ctx) const;
+
+protected:
+	typedef int (*Handler)(void *object, Context &ctx);
+	struct Route {
+		const char *method, *path;
+		size_t len;
+		bool prefix;
+		void *object;
+		Handler handler;
+	};
+
+	template <class K, int (K::*func)(Context &)>
+	static int call(void *object, Context &ctx) {
+		return (static_cast<K *>(object)->*func)(ctx);
+	}
+	void add(const char *method, const char *path, void *object, Handler handler);
+
+	std::vector<Route> routes_;
+};
+
+class Listener {
+public:
+	// Socket syscalls and requests of all loops since start
+	struct Stats {
+		uint64_t requests, reads, writes, accepts;
+	};
+
+	explicit Listener(Router &router);
+	~Listener();
+	Listener(const Listener &) = delete;
+	Listener &operator=(const Listener &) = delete;
+
+	// Loops are spinning in non blocking epoll_wait, while busyPoll returns true. Must be set before Bind
+	void SetBusyPoll(std::function<bool()> busyPoll) { busyPoll_ = busyPoll; }
+	// Called by loop, which was parked in blocking epoll_wait and is woken up by request, with time in us from
+	// arrival of request to its read. Accepted sockets get kernel receive timestamps. Must be set before Bind
+	void SetWakeupLatency(std::function<void(uint64_t)> wakeup) { wakeupLatency_ = wakeup; }
+	// Called by each loop thread with index of loop before it starts serving, e.g. to pin thread to cpu.
+	// Loop 0 runs in thread of Run. Must be set before Fork
+	void SetThreadStart(std::function<void(int)> start) { threadStart_ = start; }
+	// Each loop listens own SO_REUSEPORT socket, and kernel balances connections between loops.
+	// Must be set before Bind. Loops share socket of Bind, if kernel does not support it
+	void SetReusePort(bool reusePort) { reusePort_ = reusePort; }
+	bool Bind(int port);
+	// Starts n loop threads in addition to the one of Run. Must be called once, after Bind
+	void Fork(int n);
+	// Runs loop in calling thread until Stop, then waits for forked loops
+	void Run();
+	void Stop();
+
+	// Bound port, e.g. if Bind was called with 0
+	int Port() const { return port_; }
+	// Number of loops, which listen own socket. 1 means all loops share socket of Bind
+	int Sockets() const;
+	Stats GetStats() const;
+
+protected:
+	friend class Loop;
+	friend class Connection;
+
+	Router &router_;
+	int listen(int port);
+
+	std::function<bool()> busyPoll_;
+	std::function<void(uint64_t)> wakeupLatency_;
+	std::function<void(int)> threadStart_;
+	bool reusePort_;
+	int listenFd_, stopFd_, port_;
+	std::atomic<bool> stopping_;
+	// Loop 0 is created by Bind and is run by Run
+	std::vector<std::unique_ptr<Loop>> loops_;
+	std::vector<std::thread> threads_;
+};
+
+}  // namespace http
@@ -0,0 +1,42 @@
+#include "hugepages.h"
+#include <stdint.h>
+#include <sys/mman.h>
+
+static size_t roundUp(size_t size) { return (size + kHugePageSize - 1) & ~(kHugePageSize - 1); }
+
+const char *HugePagesName(HugePages mode) {
+	switch (mode) {
+		case HugePagesTHP:
+			return "transparent huge";
+		case HugePagesTLB:
+			return "hugetlb";
+		default:
+			return "4KB";
+	}
+}
+
+void *MapRegion(size_t size, HugePages mode, HugePages &used) {
+	size = roundUp(size);
+	if (mode == HugePagesTLB) {
+		void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			used = HugePagesTLB;
+			return p;
+		}
+		mode = HugePagesTHP;
+	}
+
+	// mmap aligns only to 4KB, and THP backs only aligned 2MB extents: so map more and trim the ends
+	char *p = static_cast<char *>(mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (p == MAP_FAILED) return nullptr;
+	char *aligned = reinterpret_cast<char *>(roundUp(reinterpret_cast<uintptr_t>(p)));
+	if (aligned != p) munmap(p, aligned - p);
+	munmap(aligned + size, p + kHugePageSize - aligned);
+
+	used = mode == HugePagesTHP && !madvise(aligned, size, MADV_HUGEPAGE) ? HugePagesTHP : HugePagesOff;
+	return aligned;
+}
+
+void UnmapRegion(void *p, size_t size) {
+	if (p) munmap(p, roundUp(size));
+}
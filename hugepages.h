@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+
+// Backing of large long living regions of memory
+enum HugePages {
+	HugePagesOff,
+	// Transparent huge pages by madvise(MADV_HUGEPAGE): kernel backs 2MB aligned parts of region when it can
+	HugePagesTHP,
+	// Preallocated huge pages by MAP_HUGETLB, they need vm.nr_hugepages. Falls back to THP if there are not enough
+	HugePagesTLB,
+};
+
+static const size_t kHugePageSize = 2 << 20;
+
+const char *HugePagesName(HugePages mode);
+
+// Maps zero filled anonymous region of at least size bytes, aligned to huge page.
+// Sets used to backing which is actually used. Returns nullptr on failure
+void *MapRegion(size_t size, HugePages mode, HugePages &used);
+void UnmapRegion(void *p, size_t size);
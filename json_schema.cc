@@ -0,0 +1,74 @@
+#include "json_schema.h"
+
+namespace jsonschema {
+
+static const char kDigits[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+char *PutInt(char *p, int v) {
+	uint32_t u = v;
+	if (v < 0) {
+		*p++ = '-';
+		u = 0u - u;
+	}
+	char *end = p + DigitsCount(u);
+	char *q = end;
+	while (u >= 100) {
+		unsigned i = (u % 100) * 2;
+		u /= 100;
+		q -= 2;
+		memcpy(q, kDigits + i, 2);
+	}
+	if (u >= 10) {
+		memcpy(q - 2, kDigits + u * 2, 2);
+	} else {
+		q[-1] = '0' + u;
+	}
+	return end;
+}
+
+// Control chars are \u00XX, except of \t, \n and \r. Quote and backslash are escaped by backslash
+const uint8_t kEscapeExtra[256] = {
+	5, 5, 5, 5, 5, 5, 5, 5, 5, 1, 1, 5, 5, 1, 5, 5,
+	5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+	0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+char *PutEscaped(char *p, const char *s, size_t len) {
+	static const char kHex[] = "0123456789abcdef";
+	for (size_t i = 0; i < len; i++) {
+		char c = s[i];
+		switch (kEscapeExtra[uint8_t(c)]) {
+			case 0:
+				*p++ = c;
+				break;
+			case 1:
+				*p++ = '\\';
+				*p++ = c == '\n' ? 'n' : c == '\r' ? 'r' : c == '\t' ? 't' : c;
+				break;
+			default:
+				memcpy(p, "\\u00", 4);
+				p[4] = kHex[uint8_t(c) >> 4];
+				p[5] = kHex[uint8_t(c) & 15];
+				p += 6;
+		}
+	}
+	return p;
+}
+
+}  // namespace jsonschema
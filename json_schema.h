@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "dictionary.h"
+
+// Compile time schemas of json responses. Object is a list of fields, and each field is a key literal
+// and a member of record, so renamed or retyped member breaks the build instead of the output.
+// Key literals carry their separators, so rendering is memcpy of fixed length keys and values.
+// Length of object is computed before rendering, and buffer is sized exactly once.
+namespace jsonschema {
+
+// Number of decimal digits of v, by log2 estimate and one compare
+inline int DigitsCount(uint32_t v) {
+	static const uint32_t kPow10[] = {0, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+	int t = ((32 - __builtin_clz(v | 1)) * 1233) >> 12;
+	return t - (v < kPow10[t]) + 1;
+}
+
+inline size_t IntLen(int v) { return v < 0 ? 1 + DigitsCount(0u - uint32_t(v)) : DigitsCount(v); }
+
+// Writes decimal v, two digits at a time by table. Returns end of written chars
+char *PutInt(char *p, int v);
+
+// Extra chars of json escaping of c: 1 for quote, backslash, \n, \r and \t, 5 for other control chars
+extern const uint8_t kEscapeExtra[256];
+
+// Length of s after json escaping
+inline size_t EscapedLen(const char *s, size_t len) {
+	size_t extra = 0;
+	for (size_t i = 0; i < len; i++) extra += kEscapeExtra[uint8_t(s[i])];
+	return len + extra;
+}
+
+// Writes json escaped s. Returns end of written chars
+char *PutEscaped(char *p, const char *s, size_t len);
+
+// Int member
+template <typename Rec, int Rec::*member>
+struct Int {
+	static const bool kQuoted = false;
+	static size_t Len(const Rec &r, const StringDict &) { return IntLen(r.*member); }
+	static char *Put(char *p, const Rec &r, const StringDict &) { return PutInt(p, r.*member); }
+};
+
+// Code of string in dictionary: json escaped form of string is written. Opening quote is in key
+template <typename Rec, uint32_t Rec::*member>
+struct Dict {
+	static const bool kQuoted = true;
+	static size_t Len(const Rec &r, const StringDict &dict) { return dict.Get(r.*member).jsonLen + 1; }
+	static char *Put(char *p, const Rec &r, const StringDict &dict) {
+		auto &e = dict.Get(r.*member);
+		memcpy(p, e.json, e.jsonLen);
+		p[e.jsonLen] = '"';
+		return p + e.jsonLen + 1;
+	}
+};
+
+// Zero terminated string, which is json escaped while written
+template <typename Rec, const char *Rec::*member>
+struct Str {
+	static const bool kQuoted = true;
+	static size_t Len(const Rec &r, const StringDict &) { return EscapedLen(r.*member, strlen(r.*member)) + 1; }
+	static char *Put(char *p, const Rec &r, const StringDict &) {
+		p = PutEscaped(p, r.*member, strlen(r.*member));
+		*p = '"';
+		return p + 1;
+	}
+};
+
+// Declares field Name, which writes member of Rec by Kind after key ,"member":
+#define JSON_FIELD(Name, Kind, Rec, member)                                                          \
+	struct Name : jsonschema::Kind<Rec, &Rec::member> {                                              \
+		typedef jsonschema::Kind<Rec, &Rec::member> Base;                                            \
+		static const char *Key() { return Base::kQuoted ? ",\"" #member "\":\"" : ",\"" #member "\":"; } \
+		static const size_t kKeyLen = sizeof(",\"" #member "\":") - 1 + Base::kQuoted;                 \
+	}
+
+template <typename... Fields>
+struct FieldList;
+
+template <>
+struct FieldList<> {
+	template <typename Rec>
+	static size_t Len(const Rec &, const StringDict &) {
+		return 0;
+	}
+	template <typename Rec>
+	static char *Put(char *p, const Rec &, const StringDict &) {
+		return p;
+	}
+};
+
+template <typename F, typename... Rest>
+struct FieldList<F, Rest...> {
+	template <typename Rec>
+	static size_t Len(const Rec &r, const StringDict &dict) {
+		return F::kKeyLen + F::Len(r, dict) + FieldList<Rest...>::Len(r, dict);
+	}
+	template <typename Rec>
+	static char *Put(char *p, const Rec &r, const StringDict &dict) {
+		memcpy(p, F::Key(), F::kKeyLen);
+		p = F::Put(p + F::kKeyLen, r, dict);
+		return FieldList<Rest...>::Put(p, r, dict);
+	}
+};
+
+// Object of fields. Leading comma of the first key is replaced by brace
+template <typename... Fields>
+struct Object {
+	static_assert(sizeof...(Fields) > 0, "Object must have fields");
+
+	template <typename Rec>
+	static size_t Len(const Rec &r, const StringDict &dict) {
+		return FieldList<Fields...>::Len(r, dict) + 1;
+	}
+	template <typename Rec>
+	static char *Put(char *p, const Rec &r, const StringDict &dict) {
+		char *end = FieldList<Fields...>::Put(p, r, dict);
+		*p = '{';
+		*end = '}';
+		return end + 1;
+	}
+};
+
+// Renders record to out, which is resized to exact length of json. String may have any allocator
+template <typename Schema, typename Rec, typename String>
+void Render(const Rec &r, const StringDict &dict, String &out) {
+	out.resize(Schema::Len(r, dict));
+	Schema::Put(&out[0], r, dict);
+}
+
+// Renders {"<name>":[...]} with objects of records. Key literal must be {"<name>":[
+template <typename Schema, typename Rec, size_t N, typename String>
+void RenderList(const char (&key)[N], const Rec *begin, const Rec *end, const StringDict &dict, String &out) {
+	size_t len = N - 1 + 2 + (end > begin ? end - begin - 1 : 0);
+	for (const Rec *r = begin; r < end; r++) len += Schema::Len(*r, dict);
+	out.resize(len);
+	char *p = &out[0];
+	memcpy(p, key, N - 1);
+	p += N - 1;
+	for (const Rec *r = begin; r < end; r++) {
+		if (r != begin) *p++ = ',';
+		p = Schema::Put(p, *r, dict);
+	}
+	memcpy(p, "]}", 2);
+}
+
+}  // namespace jsonschema
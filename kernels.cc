@@ -0,0 +1,218 @@
+
+#include "kernels.h"
+#include <immintrin.h>
+#include <string.h>
+#include <algorithm>
+
+namespace kernels {
+
+// Vector implementations are compiled with target attributes, so binary still runs on cpus without AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+
+void InitMask(uint64_t *mask, int n) {
+	int words = MaskWords(n);
+	for (int w = 0; w < words; w++) mask[w] = ~uint64_t(0);
+	if (n % 64) mask[words - 1] = (uint64_t(1) << (n % 64)) - 1;
+}
+
+// Scalar
+
+static uint64_t rangeBits(const int32_t *col, int from, int to, int32_t lo, int32_t hi) {
+	uint64_t bits = 0;
+	for (int i = from; i < to; i++) bits |= uint64_t((col[i] > lo) & (col[i] < hi)) << i;
+	return bits;
+}
+
+static uint64_t eqBits(const char *col, int from, int to, char val) {
+	uint64_t bits = 0;
+	for (int i = from; i < to; i++) bits |= uint64_t(col[i] == val) << i;
+	return bits;
+}
+
+static int64_t maskedSum(const int8_t *col, int from, int to, uint64_t bits) {
+	int64_t sum = 0;
+	for (int i = from; i < to; i++) sum += int64_t((bits >> i) & 1) * col[i];
+	return sum;
+}
+
+static void andRangeScalar(const int32_t *col, int n, int32_t lo, int32_t hi, uint64_t *mask) {
+	for (int w = 0; w * 64 < n; w++) mask[w] &= rangeBits(col + w * 64, 0, std::min(64, n - w * 64), lo, hi);
+}
+
+static void andEqScalar(const char *col, int n, char val, uint64_t *mask) {
+	for (int w = 0; w * 64 < n; w++) mask[w] &= eqBits(col + w * 64, 0, std::min(64, n - w * 64), val);
+}
+
+static void maskedSumScalar(const int8_t *col, int n, const uint64_t *mask, int64_t &sum, int &count) {
+	for (int w = 0; w * 64 < n; w++) {
+		sum += maskedSum(col + w * 64, 0, std::min(64, n - w * 64), mask[w]);
+		count += __builtin_popcountll(mask[w]);
+	}
+}
+
+// SSE4.1
+
+TARGET_SSE41 static void andRangeSSE41(const int32_t *col, int n, int32_t lo, int32_t hi, uint64_t *mask) {
+	__m128i vlo = _mm_set1_epi32(lo), vhi = _mm_set1_epi32(hi);
+	for (int w = 0; w * 64 < n; w++) {
+		const int32_t *p = col + w * 64;
+		int end = std::min(64, n - w * 64), i = 0;
+		uint64_t bits = 0;
+		for (; i + 4 <= end; i += 4) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+			__m128i m = _mm_and_si128(_mm_cmpgt_epi32(v, vlo), _mm_cmpgt_epi32(vhi, v));
+			bits |= uint64_t(_mm_movemask_ps(_mm_castsi128_ps(m))) << i;
+		}
+		mask[w] &= bits | rangeBits(p, i, end, lo, hi);
+	}
+}
+
+TARGET_SSE41 static void andEqSSE41(const char *col, int n, char val, uint64_t *mask) {
+	__m128i vval = _mm_set1_epi8(val);
+	for (int w = 0; w * 64 < n; w++) {
+		const char *p = col + w * 64;
+		int end = std::min(64, n - w * 64), i = 0;
+		uint64_t bits = 0;
+		for (; i + 16 <= end; i += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+			bits |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, vval)))) << i;
+		}
+		mask[w] &= bits | eqBits(p, i, end, val);
+	}
+}
+
+TARGET_SSE41 static void maskedSumSSE41(const int8_t *col, int n, const uint64_t *mask, int64_t &sum, int &count) {
+	const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+	__m128i acc = _mm_setzero_si128();
+	for (int w = 0; w * 64 < n; w++) {
+		const int8_t *p = col + w * 64;
+		int end = std::min(64, n - w * 64), i = 0;
+		uint64_t bits = mask[w];
+		for (; i + 4 <= end; i += 4) {
+			int32_t raw;
+			memcpy(&raw, p + i, sizeof(raw));
+			__m128i v = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(raw));
+			__m128i m = _mm_and_si128(_mm_set1_epi32(int((bits >> i) & 0xF)), lanes);
+			acc = _mm_add_epi32(acc, _mm_and_si128(v, _mm_cmpeq_epi32(m, lanes)));
+		}
+		sum += maskedSum(p, i, end, bits);
+		count += __builtin_popcountll(bits);
+	}
+	acc = _mm_hadd_epi32(acc, acc);
+	acc = _mm_hadd_epi32(acc, acc);
+	sum += _mm_cvtsi128_si32(acc);
+}
+
+// AVX2
+
+TARGET_AVX2 static void andRangeAVX2(const int32_t *col, int n, int32_t lo, int32_t hi, uint64_t *mask) {
+	__m256i vlo = _mm256_set1_epi32(lo), vhi = _mm256_set1_epi32(hi);
+	for (int w = 0; w * 64 < n; w++) {
+		const int32_t *p = col + w * 64;
+		int end = std::min(64, n - w * 64), i = 0;
+		uint64_t bits = 0;
+		for (; i + 8 <= end; i += 8) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+			__m256i m = _mm256_and_si256(_mm256_cmpgt_epi32(v, vlo), _mm256_cmpgt_epi32(vhi, v));
+			bits |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(m))) << i;
+		}
+		mask[w] &= bits | rangeBits(p, i, end, lo, hi);
+	}
+}
+
+TARGET_AVX2 static void andEqAVX2(const char *col, int n, char val, uint64_t *mask) {
+	__m256i vval = _mm256_set1_epi8(val);
+	for (int w = 0; w * 64 < n; w++) {
+		const char *p = col + w * 64;
+		int end = std::min(64, n - w * 64), i = 0;
+		uint64_t bits = 0;
+		for (; i + 32 <= end; i += 32) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+			bits |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vval)))) << i;
+		}
+		mask[w] &= bits | eqBits(p, i, end, val);
+	}
+}
+
+TARGET_AVX2 static void maskedSumAVX2(const int8_t *col, int n, const uint64_t *mask, int64_t &sum, int &count) {
+	const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i acc = _mm256_setzero_si256();
+	for (int w = 0; w * 64 < n; w++) {
+		const int8_t *p = col + w * 64;
+		int end = std::min(64, n - w * 64), i = 0;
+		uint64_t bits = mask[w];
+		for (; i + 8 <= end; i += 8) {
+			__m256i v = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p + i)));
+			__m256i m = _mm256_and_si256(_mm256_set1_epi32(int((bits >> i) & 0xFF)), lanes);
+			acc = _mm256_add_epi32(acc, _mm256_and_si256(v, _mm256_cmpeq_epi32(m, lanes)));
+		}
+		sum += maskedSum(p, i, end, bits);
+		count += __builtin_popcountll(bits);
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	s = _mm_hadd_epi32(s, s);
+	s = _mm_hadd_epi32(s, s);
+	sum += _mm_cvtsi128_si32(s);
+}
+
+// Dispatch
+
+struct Table {
+	Impl impl;
+	void (*andRange)(const int32_t *, int, int32_t, int32_t, uint64_t *);
+	void (*andEq)(const char *, int, char, uint64_t *);
+	void (*maskedSum)(const int8_t *, int, const uint64_t *, int64_t &, int &);
+};
+
+static const Table tables[] = {
+	{ImplScalar, andRangeScalar, andEqScalar, maskedSumScalar},
+	{ImplSSE41, andRangeSSE41, andEqSSE41, maskedSumSSE41},
+	{ImplAVX2, andRangeAVX2, andEqAVX2, maskedSumAVX2},
+};
+
+static bool supported(Impl impl) {
+	switch (impl) {
+		case ImplAVX2:
+			return __builtin_cpu_supports("avx2");
+		case ImplSSE41:
+			return __builtin_cpu_supports("sse4.1");
+		default:
+			return true;
+	}
+}
+
+static const Table *selectBest() {
+	// It runs from static constructor, so cpu info may be not initialized yet
+	__builtin_cpu_init();
+	if (supported(ImplAVX2)) return &tables[ImplAVX2];
+	if (supported(ImplSSE41)) return &tables[ImplSSE41];
+	return &tables[ImplScalar];
+}
+
+static const Table *table = selectBest();
+
+void AndRange(const int32_t *col, int n, int32_t lo, int32_t hi, uint64_t *mask) { table->andRange(col, n, lo, hi, mask); }
+void AndEq(const char *col, int n, char val, uint64_t *mask) { table->andEq(col, n, val, mask); }
+void MaskedSum(const int8_t *col, int n, const uint64_t *mask, int64_t &sum, int &count) { table->maskedSum(col, n, mask, sum, count); }
+
+bool SetImpl(Impl impl) {
+	if (!supported(impl)) return false;
+	table = &tables[impl];
+	return true;
+}
+
+Impl GetImpl() { return table->impl; }
+
+const char *ImplName(Impl impl) {
+	switch (impl) {
+		case ImplAVX2:
+			return "avx2";
+		case ImplSSE41:
+			return "sse4.1";
+		default:
+			return "scalar";
+	}
+}
+
+}  // namespace kernels
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// Filter kernels for column scans of visits.
+// Mask is an array of 64 bit words, bit i%64 of word i/64 is row i. Each filter kernel AND-s its
+// predicate into the mask, so predicates are combined by calling kernels in turn.
+// Implementation is selected at startup by cpu features: AVX2, SSE4.1 or scalar fallback.
+namespace kernels {
+
+enum Impl { ImplScalar, ImplSSE41, ImplAVX2 };
+
+// Number of mask words for n rows
+inline int MaskWords(int n) { return (n + 63) / 64; }
+
+// Sets bits of first n rows, and clears the rest of the last word
+void InitMask(uint64_t *mask, int n);
+// lo < col[i] < hi
+void AndRange(const int32_t *col, int n, int32_t lo, int32_t hi, uint64_t *mask);
+// col[i] == val
+void AndEq(const char *col, int n, char val, uint64_t *mask);
+// Adds sum of col[i] and count of rows in mask to sum and count
+void MaskedSum(const int8_t *col, int n, const uint64_t *mask, int64_t &sum, int &count);
+
+// Forces implementation, e.g. for benchmarks. Returns false, if cpu does not support it
+bool SetImpl(Impl impl);
+Impl GetImpl();
+const char *ImplName(Impl impl);
+
+}  // namespace kernels
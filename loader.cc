@@ -0,0 +1,191 @@
+
+#include "loader.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "entity_parser.h"
+#include "tools/logger.h"
+
+using namespace reindexer;
+using std::string;
+using std::vector;
+
+// Chunk size is a tradeoff between parallelism on small files and the per chunk overhead
+static const size_t kChunkSize = 1 << 20;
+
+MappedFile::~MappedFile() {
+	if (data_) munmap(data_, size_);
+}
+
+bool MappedFile::Open(const string &path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		logPrintf(LogError, "Can't open %s", path.c_str());
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return false;
+	}
+	size_ = st.st_size;
+	void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		logPrintf(LogError, "Can't mmap %s", path.c_str());
+		size_ = 0;
+		return false;
+	}
+	madvise(p, size_, MADV_SEQUENTIAL);
+	data_ = reinterpret_cast<char *>(p);
+	return true;
+}
+
+BulkLoader::BulkLoader(const string &dir, int threads) : dir_(dir), threads_(threads) {
+	if (threads_ <= 0) threads_ = std::max(1u, std::thread::hardware_concurrency());
+}
+
+BulkLoader::~BulkLoader() {}
+
+bool BulkLoader::mapFiles(const char *prefix, Kind kind) {
+	size_t len = strlen(prefix);
+	DIR *dirp = opendir(dir_.c_str());
+	if (!dirp) {
+		logPrintf(LogError, "Can't open data dir %s", dir_.c_str());
+		return false;
+	}
+
+	dirent *dp;
+	while ((dp = readdir(dirp)) != nullptr) {
+		if (strlen(dp->d_name) < len || strncmp(dp->d_name, prefix, len)) continue;
+
+		std::unique_ptr<MappedFile> file(new MappedFile);
+		if (!file->Open(dir_ + "/" + dp->d_name)) continue;
+		splitFile(file->Data(), file->Size(), kind);
+		files_.push_back(std::move(file));
+	}
+	closedir(dirp);
+	return true;
+}
+
+// Each file is {"<ns>": [{...}, {...}]}, and entity objects are flat.
+// So chunk boundary is just the first '{' after the desired offset inside the array.
+void BulkLoader::splitFile(char *data, size_t size, Kind kind) {
+	char *beg = reinterpret_cast<char *>(memchr(data, '[', size));
+	char *end = reinterpret_cast<char *>(memrchr(data, ']', size));
+	if (!beg || !end || end < beg) return;
+
+	while (beg < end) {
+		char *cend = beg + std::min(kChunkSize, size_t(end - beg));
+		if (cend < end) {
+			cend = reinterpret_cast<char *>(memchr(cend, '{', end - cend));
+			if (!cend) cend = end;
+		}
+		std::unique_ptr<Chunk> chunk(new Chunk);
+		chunk->kind = kind;
+		chunk->beg = beg;
+		chunk->end = cend;
+		chunk->ok = true;
+		chunks_.push_back(std::move(chunk));
+		beg = cend;
+	}
+}
+
+// Parses all objects, which are started inside chunk
+void BulkLoader::parseChunk(Chunk &chunk) {
+	char *p = reinterpret_cast<char *>(memchr(chunk.beg, '{', chunk.end - chunk.beg));
+
+	while (p) {
+		unsigned fields = 0;
+		bool ok = false;
+		switch (chunk.kind) {
+			case KindUser:
+				chunk.users.push_back(User{-1, 0, "", "", "", ""});
+				ok = ParseUser(p, chunk.end, chunk.users.back(), fields) && chunk.users.back().id >= 0;
+				break;
+			case KindLocation:
+				chunk.locations.push_back(Location{-1, 0, "", "", ""});
+				ok = ParseLocation(p, chunk.end, chunk.locations.back(), fields) && chunk.locations.back().id >= 0;
+				break;
+			case KindVisit:
+				chunk.visits.push_back(Visit{-1, 0, 0, 0, 0});
+				ok = ParseVisit(p, chunk.end, chunk.visits.back(), fields) && chunk.visits.back().id >= 0;
+				break;
+		}
+		if (!ok) {
+			chunk.ok = false;
+			break;
+		}
+		p = p < chunk.end ? reinterpret_cast<char *>(memchr(p, '{', chunk.end - p)) : nullptr;
+	}
+}
+
+template <typename T>
+void BulkLoader::collect(vector<T> &to, vector<T> Chunk::*from) {
+	size_t total = 0;
+	for (auto &chunk : chunks_) total += ((*chunk).*from).size();
+	to.reserve(total);
+	for (auto &chunk : chunks_) {
+		auto &v = (*chunk).*from;
+		to.insert(to.end(), v.begin(), v.end());
+		vector<T>().swap(v);
+	}
+}
+
+bool BulkLoader::Load() {
+	static const struct {
+		const char *prefix;
+		Kind kind;
+	} kinds[] = {{"users", KindUser}, {"locations", KindLocation}, {"visits", KindVisit}};
+
+	for (auto &k : kinds) {
+		auto tmStart = std::chrono::steady_clock::now();
+		if (!mapFiles(k.prefix, k.kind)) return false;
+
+		std::atomic<size_t> nextChunk(0);
+		vector<std::thread> workers;
+		int nthreads = std::min(threads_, int(chunks_.size()));
+		for (int i = 0; i < nthreads; i++) {
+			workers.push_back(std::thread([&]() {
+				for (size_t n = nextChunk++; n < chunks_.size(); n = nextChunk++) parseChunk(*chunks_[n]);
+			}));
+		}
+		for (auto &th : workers) th.join();
+
+		for (auto &chunk : chunks_) {
+			if (!chunk->ok) {
+				logPrintf(LogError, "Can't parse %s json near offset '%.32s'", k.prefix, chunk->beg);
+				return false;
+			}
+		}
+
+		size_t count = 0;
+		switch (k.kind) {
+			case KindUser:
+				collect(users_, &Chunk::users);
+				count = users_.size();
+				break;
+			case KindLocation:
+				collect(locations_, &Chunk::locations);
+				count = locations_.size();
+				break;
+			case KindVisit:
+				collect(visits_, &Chunk::visits);
+				count = visits_.size();
+				break;
+		}
+
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tmStart).count();
+		logPrintf(LogInfo, "Parsed %d %s from %d chunks in %dms (%d obj/sec, %d threads)", int(count), k.prefix, int(chunks_.size()),
+				  int(ms), int(count * 1000 / std::max(ms, decltype(ms)(1))), nthreads);
+		chunks_.clear();
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "entities.h"
+
+// Read only view of the file, mapped privately: json parser decodes strings in place
+class MappedFile {
+public:
+	MappedFile() : data_(nullptr), size_(0) {}
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool Open(const std::string &path);
+	char *Data() const { return data_; }
+	size_t Size() const { return size_; }
+
+protected:
+	char *data_;
+	size_t size_;
+};
+
+// Loads users_*, locations_* and visits_* files from data dir.
+// Files are mmaped, split to chunks on object boundaries and chunks are parsed on all cores.
+// Parsed records are referencing strings inside mapped files, so loader must outlive them.
+class BulkLoader {
+public:
+	BulkLoader(const std::string &dir, int threads = 0);
+	~BulkLoader();
+
+	bool Load();
+
+	const std::vector<User> &Users() const { return users_; }
+	const std::vector<Location> &Locations() const { return locations_; }
+	const std::vector<Visit> &Visits() const { return visits_; }
+
+protected:
+	enum Kind { KindUser, KindLocation, KindVisit };
+	struct Chunk {
+		Kind kind;
+		char *beg, *end;
+		std::vector<User> users;
+		std::vector<Location> locations;
+		std::vector<Visit> visits;
+		bool ok;
+	};
+
+	bool mapFiles(const char *prefix, Kind kind);
+	void splitFile(char *data, size_t size, Kind kind);
+	void parseChunk(Chunk &chunk);
+	template <typename T>
+	void collect(std::vector<T> &to, std::vector<T> Chunk::*from);
+
+	std::string dir_;
+	int threads_;
+	std::vector<std::unique_ptr<MappedFile>> files_;
+	std::vector<std::unique_ptr<Chunk>> chunks_;
+	std::vector<User> users_;
+	std::vector<Location> locations_;
+	std::vector<Visit> visits_;
+};
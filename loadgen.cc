@@ -0,0 +1,302 @@
+
+#include "loadgen.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+
+using std::string;
+using std::vector;
+
+struct LoadGen::Conn {
+	struct Request {
+		const Ammo *ammo;
+		uint64_t scheduledUs;
+	};
+	int fd = -1;
+	// Requests in order of responses. Their bytes are appended to out, and out is sent at once
+	std::deque<Request> inflight;
+	string out;
+	size_t sent = 0;
+	string in;
+};
+
+static uint64_t nowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "GET /users/12/visits?fromDate=1 HTTP/1.1" -> "GET /users/:id/visits"
+static string endpointOf(const string &request) {
+	size_t sp = request.find(' ');
+	if (sp == string::npos) return "unknown";
+	string endpoint = request.substr(0, sp + 1);
+	size_t p = sp + 1;
+	while (p < request.size() && request[p] != ' ' && request[p] != '?' && request[p] != '\r') {
+		size_t seg = p;
+		while (p < request.size() && isdigit(request[p])) p++;
+		if (p > seg && (p == request.size() || request[p] == '/' || request[p] == ' ' || request[p] == '?' || request[p] == '\r')) {
+			endpoint += ":id";
+		} else {
+			endpoint += request[p++];
+		}
+	}
+	return endpoint;
+}
+
+bool LoadAmmo(const string &path, vector<Ammo> &ammo) {
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		size_t size = strtoul(line, nullptr, 10);
+		if (!size) continue;
+		Ammo a;
+		a.request.resize(size);
+		if (fread(&a.request[0], 1, size, f) != size) break;
+		a.endpoint = endpointOf(a.request);
+		ammo.push_back(std::move(a));
+	}
+	fclose(f);
+	return !ammo.empty();
+}
+
+Ammo MakeGetAmmo(const string &path) {
+	Ammo a;
+	a.request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nUser-Agent: hlcup_bench\r\n\r\n";
+	a.endpoint = endpointOf(a.request);
+	return a;
+}
+
+LoadGen::LoadGen(const Options &opts)
+	: opts_(opts), epfd_(epoll_create1(0)), inflight_(0), sendCalls_(0), readCalls_(0), elapsedSec_(0) {
+	for (int i = 0; i < std::max(1, opts_.connections); i++) conns_.emplace_back(new Conn);
+}
+
+LoadGen::~LoadGen() {
+	for (auto &c : conns_) close(*c);
+	::close(epfd_);
+}
+
+bool LoadGen::connect(Conn &c) {
+	c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (c.fd < 0) return false;
+	int one = 1;
+	setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opts_.port);
+	addr.sin_addr.s_addr = inet_addr(opts_.host.c_str());
+	if (::connect(c.fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS) {
+		close(c);
+		return false;
+	}
+
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = &c;
+	epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+	return true;
+}
+
+void LoadGen::close(Conn &c) {
+	c.out.clear();
+	c.sent = 0;
+	c.in.clear();
+	if (c.fd < 0) return;
+	epoll_ctl(epfd_, EPOLL_CTL_DEL, c.fd, nullptr);
+	::close(c.fd);
+	c.fd = -1;
+}
+
+// Sends as much as socket accepts. The rest is sent on EPOLLOUT
+bool LoadGen::send(Conn &c) {
+	while (c.sent < c.out.size()) {
+		ssize_t n = ::send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+		sendCalls_++;
+		if (n < 0) return errno == EAGAIN;
+		c.sent += n;
+	}
+	c.out.clear();
+	c.sent = 0;
+	return true;
+}
+
+// Length of chunked body, which starts at pos, or 0 if it's not complete yet. Trailers are not supported
+static size_t chunkedLength(const string &in, size_t pos) {
+	for (size_t p = pos;;) {
+		size_t eol = in.find("\r\n", p);
+		if (eol == string::npos) return 0;
+		size_t size = strtoul(in.c_str() + p, nullptr, 16);
+		p = eol + 2 + size + 2;
+		if (p > in.size()) return 0;
+		if (!size) return p - pos;
+	}
+}
+
+bool LoadGen::receive(Conn &c) {
+	bool eof = false;
+	char buf[0x10000];
+	for (;;) {
+		ssize_t n = read(c.fd, buf, sizeof(buf));
+		readCalls_++;
+		if (n > 0) {
+			c.in.append(buf, n);
+		} else if (n == 0) {
+			eof = true;
+			break;
+		} else if (errno == EAGAIN) {
+			break;
+		} else {
+			return false;
+		}
+	}
+
+	// Pipelined responses may arrive together, and the last one may be incomplete
+	size_t pos = 0;
+	bool connClose = false;
+	while (!connClose && pos < c.in.size()) {
+		size_t hdrEnd = c.in.find("\r\n\r\n", pos);
+		if (hdrEnd == string::npos) break;
+		if (c.in.compare(pos, 5, "HTTP/") || hdrEnd - pos < 12 || c.inflight.empty()) return false;
+
+		int code = atoi(c.in.c_str() + pos + 9);
+		const char *clen = nullptr;
+		bool chunked = false;
+		for (size_t p = c.in.find("\r\n", pos); p < hdrEnd; p = c.in.find("\r\n", p + 2)) {
+			const char *hdr = c.in.c_str() + p + 2;
+			if (!strncasecmp(hdr, "Content-Length:", 15)) clen = hdr + 15;
+			if (!strncasecmp(hdr, "Transfer-Encoding: chunked", 26)) chunked = true;
+			if (!strncasecmp(hdr, "Connection: close", 17)) connClose = true;
+		}
+
+		size_t end = hdrEnd + 4;
+		if (clen) {
+			end += strtoul(clen, nullptr, 10);
+			if (c.in.size() < end) break;
+		} else if (chunked) {
+			size_t len = chunkedLength(c.in, end);
+			if (!len) break;
+			end += len;
+		} else if (eof) {
+			// Body is delimited by close of connection
+			end = c.in.size();
+			connClose = true;
+		} else {
+			break;
+		}
+		complete(c, code, end - pos);
+		pos = end;
+	}
+	c.in.erase(0, pos);
+	return !eof && !connClose;
+}
+
+void LoadGen::complete(Conn &c, int status, size_t bytes) {
+	auto &st = stats_[c.inflight.front().ammo->endpoint];
+	if (!st) st.reset(new EndpointStats);
+	st->latency.Record(nowUs() - c.inflight.front().scheduledUs);
+	st->bytesIn += bytes;
+	if (status >= 200 && status < 300) {
+		st->status2xx++;
+	} else if (status >= 400 && status < 500) {
+		st->status4xx++;
+	} else if (status >= 500) {
+		st->status5xx++;
+	} else {
+		st->errors++;
+	}
+	c.inflight.pop_front();
+	inflight_--;
+	idle_.push_back(&c);
+}
+
+void LoadGen::fail(Conn &c) {
+	close(c);
+	while (!c.inflight.empty()) complete(c, 0, 0);
+}
+
+bool LoadGen::Run(const vector<Ammo> &ammo) {
+	stats_.clear();
+	idle_.clear();
+	sendCalls_ = readCalls_ = 0;
+	for (auto &c : conns_) {
+		if (c->fd < 0 && !connect(*c)) return false;
+		for (int i = 0; i < std::max(1, opts_.pipeline); i++) idle_.push_back(c.get());
+	}
+
+	vector<epoll_event> events(conns_.size());
+	vector<Conn *> dirty;
+	uint64_t start = nowUs();
+	size_t next = 0;
+
+	while (next < ammo.size() || inflight_) {
+		// Dispatch requests, which are due, to free slots. Requests dispatched to the same connection
+		// in one pass are pipelined, and sent after dispatch by one send
+		uint64_t now = nowUs(), due = now;
+		dirty.clear();
+		while (next < ammo.size() && !idle_.empty()) {
+			due = opts_.rps ? start + next * 1000000 / opts_.rps : now;
+			if (due > now) break;
+			Conn &c = *idle_.back();
+			idle_.pop_back();
+			c.inflight.push_back(Conn::Request{&ammo[next++], due});
+			inflight_++;
+			if (c.fd < 0 && !connect(c)) {
+				fail(c);
+				continue;
+			}
+			c.out += c.inflight.back().ammo->request;
+			dirty.push_back(&c);
+		}
+		for (auto c : dirty) {
+			if (c->fd >= 0 && c->sent == 0 && !c->out.empty() && !send(*c)) fail(*c);
+		}
+
+		int timeout = 100;
+		if (next < ammo.size() && !idle_.empty()) timeout = due > now ? int((due - now) / 1000) : 0;
+		int n = epoll_wait(epfd_, events.data(), events.size(), timeout);
+		for (int i = 0; i < n; i++) {
+			Conn &c = *reinterpret_cast<Conn *>(events[i].data.ptr);
+			if (c.inflight.empty()) {
+				// Idle connection is closed by server. It will be reconnected on next request
+				if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) close(c);
+				continue;
+			}
+			if ((events[i].events & EPOLLOUT) && c.sent < c.out.size() && !send(c)) {
+				fail(c);
+			} else if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !receive(c)) {
+				fail(c);
+			}
+		}
+	}
+	elapsedSec_ = double(nowUs() - start) / 1e6;
+	return true;
+}
+
+void LoadGen::Report(FILE *f) const {
+	fprintf(f, "%-32s %8s %9s %8s %8s %8s %8s %8s %8s %8s %6s\n", "endpoint", "requests", "req/s", "p50,us", "p90,us", "p99,us",
+			"p99.9,us", "max,us", "2xx", "4xx", "errors");
+	for (auto &it : stats_) {
+		auto &st = *it.second;
+		fprintf(f, "%-32s %8d %9.0f %8d %8d %8d %8d %8d %8d %8d %6d\n", it.first.c_str(), int(st.latency.Count()),
+				st.latency.Count() / std::max(elapsedSec_, 1e-6), int(st.latency.Percentile(50)), int(st.latency.Percentile(90)),
+				int(st.latency.Percentile(99)), int(st.latency.Percentile(99.9)), int(st.latency.Max()), int(st.status2xx),
+				int(st.status4xx), int(st.errors + st.status5xx));
+	}
+	uint64_t requests = 0;
+	for (auto &it : stats_) requests += it.second->latency.Count();
+	fprintf(f, "pipeline depth %d, syscalls per request: send %.2f, read %.2f\n", std::max(1, opts_.pipeline),
+			double(sendCalls_) / std::max(requests, uint64_t(1)), double(readCalls_) / std::max(requests, uint64_t(1)));
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "histogram.h"
+
+// Request to replay: raw http request and endpoint it is accounted to
+struct Ammo {
+	std::string endpoint;
+	std::string request;
+};
+
+// Loads ammo file in tank format: each request is preceded by "<size> [tag]\n" line.
+// Endpoint is made from request line, with numeric path segments replaced by ":id"
+bool LoadAmmo(const std::string &path, std::vector<Ammo> &ammo);
+
+// Builds keep-alive GET request for path
+Ammo MakeGetAmmo(const std::string &path);
+
+// Replays requests over keep-alive connections at target rate, and collects per endpoint latency histograms.
+// Latency is measured from the scheduled send time, so stalls of server are not hidden by waiting connections.
+// With pipeline depth > 1 each connection has up to depth requests in flight, and requests which are due
+// together are sent by one send()
+class LoadGen {
+public:
+	struct Options {
+		std::string host;
+		int port;
+		int connections;
+		// Target requests per second, 0 is as fast as possible
+		int rps;
+		// Max requests in flight per connection
+		int pipeline;
+	};
+
+	struct EndpointStats {
+		LatencyHistogram latency;
+		uint64_t status2xx = 0, status4xx = 0, status5xx = 0, errors = 0;
+		uint64_t bytesIn = 0;
+	};
+
+	LoadGen(const Options &opts);
+	~LoadGen();
+
+	// Replays all requests once. Returns false if can't connect to server
+	bool Run(const std::vector<Ammo> &ammo);
+	// Prints per endpoint throughput and latency percentiles of the last run
+	void Report(FILE *f) const;
+
+protected:
+	struct Conn;
+
+	bool connect(Conn &c);
+	void close(Conn &c);
+	bool send(Conn &c);
+	// Completes all the received responses. Returns false, if connection is failed or closed by server
+	bool receive(Conn &c);
+	// Completes the oldest request of connection and frees its slot
+	void complete(Conn &c, int status, size_t bytes);
+	// Closes connection and completes all its requests as errors
+	void fail(Conn &c);
+
+	Options opts_;
+	int epfd_;
+	std::vector<std::unique_ptr<Conn>> conns_;
+	// Free request slots: each connection is here once per request it can take
+	std::vector<Conn *> idle_;
+	size_t inflight_;
+	std::map<std::string, std::unique_ptr<EndpointStats>> stats_;
+	uint64_t sendCalls_, readCalls_;
+	double elapsedSec_;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Thread safe LRU cache with string keys and copyable values. Capacity is in entries.
+// Lookups are under one mutex, so values should be cheap to copy compared to building them.
+// Entries are indexed by hash of key, so lookup does not allocate a key string. Key of entry is
+// compared on hit, and entry with colliding hash is replaced on insert.
+template <typename V>
+class LruCache {
+public:
+	explicit LruCache(size_t capacity) : capacity_(capacity), hits_(0), misses_(0) {}
+	LruCache(const LruCache &) = delete;
+	LruCache &operator=(const LruCache &) = delete;
+
+	// Copies cached value to val and makes it the most recently used
+	bool Get(const char *key, size_t len, V &val) {
+		uint64_t h = hash(key, len);
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto it = map_.find(h);
+		if (it == map_.end() || it->second->first.compare(0, std::string::npos, key, len)) {
+			misses_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		lru_.splice(lru_.begin(), lru_, it->second);
+		val = it->second->second;
+		hits_.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Inserts or replaces value, evicting the least recently used entries over capacity
+	void Put(const char *key, size_t len, const V &val) {
+		uint64_t h = hash(key, len);
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto it = map_.find(h);
+		if (it != map_.end()) {
+			it->second->first.assign(key, len);
+			it->second->second = val;
+			lru_.splice(lru_.begin(), lru_, it->second);
+			return;
+		}
+		lru_.emplace_front(std::string(key, len), val);
+		map_.emplace(h, lru_.begin());
+		while (map_.size() > capacity_) {
+			map_.erase(hash(lru_.back().first.data(), lru_.back().first.size()));
+			lru_.pop_back();
+		}
+	}
+
+	size_t Size() const {
+		std::lock_guard<std::mutex> lock(mtx_);
+		return map_.size();
+	}
+	uint64_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+	uint64_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+protected:
+	typedef std::list<std::pair<std::string, V>> List;
+
+	static uint64_t hash(const char *s, size_t len) {
+		uint64_t h = 14695981039346656037ull;
+		for (size_t i = 0; i < len; i++) h = (h ^ uint8_t(s[i])) * 1099511628211ull;
+		return h;
+	}
+
+	size_t capacity_;
+	List lru_;
+	std::unordered_map<uint64_t, typename List::iterator> map_;
+	mutable std::mutex mtx_;
+	std::atomic<uint64_t> hits_, misses_;
+};
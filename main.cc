@@ -1,15 +1,27 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "core/reindexer.h"
 #include "pprof/backtrace.h"
 #include "server.h"
 #include "time/fast_time.h"
+#include "tools/allocdebug.h"
 #include "tools/logger.h"
 
 using namespace reindexer;
 
 const string kDataDir = "/go/data/";
+const string kSnapshotPath = "/tmp/hlcup_reindex.snapshot";
 const int logLevel = 3;
 const int kHttpPort = 80;
+const int kHttpThreads = 4;
+const int kResultCacheMb = 256;
+
+// Number of loop threads, pinning them to cpus, SO_REUSEPORT sockets of loops, huge pages backing of store
+// and size of result cache are overridable from environment
+static int envInt(const char *name, int def) {
+	const char *val = getenv(name);
+	return val ? atoi(val) : def;
+}
 
 int main(int, const char **) {
 	auto db = std::make_shared<reindexer::Reindexer>();
@@ -22,8 +34,12 @@ int main(int, const char **) {
 			fprintf(stderr, "%02d:%02d:%02d %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec, buf);
 		}
 	});
+	// Heap allocations are counted by tools/allocdebug only if it's enabled. /stats shows them per request
+	if (envInt("ALLOC_DEBUG", 0)) allocdebug_init();
 	Server server(db);
-	server.LoadData(kDataDir);
-	server.Start(kHttpPort);
+	server.SetHugePages(HugePages(envInt("HUGE_PAGES", HugePagesOff)));
+	server.SetResultCache(size_t(envInt("RESULT_CACHE_MB", kResultCacheMb)) << 20);
+	server.LoadData(kDataDir, kSnapshotPath);
+	server.Start(kHttpPort, envInt("HTTP_THREADS", kHttpThreads), envInt("HTTP_PIN_CPUS", 0), envInt("HTTP_REUSEPORT", 1));
 	return 0;
 }
@@ -0,0 +1,46 @@
+#include "render_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+RenderCache::RenderCache(EpochManager &epochs) : epochs_(epochs), size_(0) {}
+
+RenderCache::~RenderCache() {
+	bodies_.ForEach([](int, const char *p) { free(const_cast<char *>(p)); });
+}
+
+char *RenderCache::alloc(const char *data, size_t len) {
+	char *p = static_cast<char *>(malloc(sizeof(uint32_t) + len));
+	uint32_t l = len;
+	memcpy(p, &l, sizeof(l));
+	memcpy(p + sizeof(l), data, len);
+	return p;
+}
+
+RenderCache::Body RenderCache::Fill(int id, const char *data, size_t len) {
+	auto e = bodies_.Slot(id);
+	if (!e) return Body{data, uint32_t(len)};
+
+	const char *expected = nullptr;
+	char *p = alloc(data, len);
+	if (!e->compare_exchange_strong(expected, p, std::memory_order_acq_rel)) {
+		// Somebody was faster. Our copy was never published, so it's freed at once
+		free(p);
+		return toBody(expected);
+	}
+	size_.fetch_add(bytes(p), std::memory_order_relaxed);
+	return toBody(p);
+}
+
+void RenderCache::Put(int id, const char *data, size_t len) {
+	auto e = bodies_.Slot(id);
+	if (!e) return;
+	char *p = alloc(data, len);
+	const char *old = e->exchange(p, std::memory_order_acq_rel);
+	size_.fetch_add(bytes(p), std::memory_order_relaxed);
+	if (old) {
+		size_.fetch_sub(bytes(old), std::memory_order_relaxed);
+		epochs_.Retire(const_cast<char *>(old));
+	}
+}
+
+size_t RenderCache::MemUsage() const { return bodies_.MemUsage() + size_.load(std::memory_order_relaxed); }
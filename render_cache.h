@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "store.h"
+
+// Pre rendered response bodies of entities, indexed by id.
+// Body is rendered once on first GET (Fill) and replaced on each update of entity (Put).
+// Bodies are kept length prefixed in own malloc blocks, so entry is just one pointer per id, and
+// neither readers nor writers take locks. Replaced body is retired to epoch manager of store,
+// so readers must hold its guard while they use body.
+//
+// Fill publishes body only if there is no body yet, and writers always Put fresh body after
+// update of record. So body rendered by reader from stale record can never override fresh one.
+class RenderCache {
+public:
+	struct Body {
+		const char *data;
+		uint32_t len;
+		explicit operator bool() const { return data != nullptr; }
+	};
+
+	explicit RenderCache(EpochManager &epochs);
+	~RenderCache();
+	RenderCache(const RenderCache &) = delete;
+	RenderCache &operator=(const RenderCache &) = delete;
+
+	Body Get(int id) const { return toBody(bodies_.Get(id)); }
+	// Publishes body rendered by reader. Returns actual body of entity
+	Body Fill(int id, const char *data, size_t len);
+	// Publishes body rendered by writer after update of entity
+	void Put(int id, const char *data, size_t len);
+
+	size_t MemUsage() const;
+
+protected:
+	static Body toBody(const char *p) {
+		if (!p) return Body{nullptr, 0};
+		uint32_t len;
+		memcpy(&len, p, sizeof(len));
+		return Body{p + sizeof(len), len};
+	}
+	static size_t bytes(const char *p) { return p ? sizeof(uint32_t) + toBody(p).len : 0; }
+	static char *alloc(const char *data, size_t len);
+
+	EpochManager &epochs_;
+	PtrTable<const char> bodies_;
+	// Bytes of published bodies
+	std::atomic<size_t> size_;
+};
@@ -0,0 +1,63 @@
+#include "request_arena.h"
+#include <stdlib.h>
+#include <algorithm>
+
+const size_t RequestArena::kFirstChunk;
+const size_t RequestArena::kMaxKept;
+
+// Allocations are aligned as malloc ones
+static const size_t kAlign = 16;
+
+RequestArena::RequestArena() : chunks_(nullptr), pos_(nullptr), left_(0), capacity_(0) {}
+
+RequestArena::~RequestArena() {
+	while (chunks_) {
+		Chunk *next = chunks_->next;
+		free(chunks_);
+		chunks_ = next;
+	}
+}
+
+RequestArena &RequestArena::Local() {
+	static thread_local RequestArena arena;
+	return arena;
+}
+
+void RequestArena::addChunk(size_t size) {
+	Chunk *c = static_cast<Chunk *>(malloc(sizeof(Chunk) + size));
+	if (!c) abort();
+	c->next = chunks_;
+	c->size = size;
+	chunks_ = c;
+	pos_ = reinterpret_cast<char *>(c + 1);
+	left_ = size;
+	capacity_ += size;
+}
+
+void *RequestArena::Alloc(size_t size) {
+	size = (size + kAlign - 1) & ~(kAlign - 1);
+	if (size > left_) addChunk(std::max(size, std::max(kFirstChunk, capacity_)));
+	void *p = pos_;
+	pos_ += size;
+	left_ -= size;
+	return p;
+}
+
+// Request, which needed several chunks, will fit in one merged chunk next time
+void RequestArena::Reset() {
+	if (chunks_ && (chunks_->next || capacity_ > kMaxKept)) {
+		size_t size = std::min(capacity_, kMaxKept);
+		while (chunks_) {
+			Chunk *next = chunks_->next;
+			free(chunks_);
+			chunks_ = next;
+		}
+		capacity_ = 0;
+		addChunk(size);
+		return;
+	}
+	if (chunks_) {
+		pos_ = reinterpret_cast<char *>(chunks_ + 1);
+		left_ = chunks_->size;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Bump allocator for scratch memory of one request: response bodies, rows, normalized sql.
+// Each loop thread has own arena, which is reset after each request, so in steady state handlers don't
+// touch global heap. Chunks are kept between requests, and chunks grown by a large request are merged
+// into one on reset, up to kMaxKept bytes.
+class RequestArena {
+public:
+	// Resets arena of calling thread at the end of scope
+	class Scope {
+	public:
+		Scope() : arena_(Local()) {}
+		~Scope() { arena_.Reset(); }
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+	protected:
+		RequestArena &arena_;
+	};
+
+	RequestArena();
+	~RequestArena();
+	RequestArena(const RequestArena &) = delete;
+	RequestArena &operator=(const RequestArena &) = delete;
+
+	static RequestArena &Local();
+
+	void *Alloc(size_t size);
+	void Reset();
+	// Bytes of chunks
+	size_t Capacity() const { return capacity_; }
+
+protected:
+	static const size_t kFirstChunk = 64 << 10;
+	static const size_t kMaxKept = 1 << 20;
+
+	struct Chunk {
+		Chunk *next;
+		size_t size;
+	};
+	void addChunk(size_t size);
+
+	Chunk *chunks_;
+	char *pos_;
+	size_t left_;
+	size_t capacity_;
+};
+
+// STL allocator from arena. Memory is freed only by reset of arena
+template <typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(RequestArena &arena) : arena_(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena_) {}
+
+	T *allocate(size_t n) { return static_cast<T *>(arena_->Alloc(n * sizeof(T))); }
+	void deallocate(T *, size_t) {}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U> &other) const {
+		return arena_ == other.arena_;
+	}
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U> &other) const {
+		return arena_ != other.arena_;
+	}
+
+	RequestArena *arena_;
+};
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "entities.h"
+#include "json_schema.h"
+#include "store.h"
+
+// Schemas of responses, shared by server and benchmarks. Order of fields is order of keys in response
+struct VisitJSON {
+	JSON_FIELD(Id, Int, Visit, id);
+	JSON_FIELD(User, Int, Visit, user);
+	JSON_FIELD(Location, Int, Visit, location);
+	JSON_FIELD(VisitedAt, Int, Visit, visited_at);
+	JSON_FIELD(Mark, Int, Visit, mark);
+	typedef jsonschema::Object<Id, User, Location, VisitedAt, Mark> Schema;
+};
+
+struct UserJSON {
+	JSON_FIELD(Id, Int, StoredUser, id);
+	JSON_FIELD(Gender, Dict, StoredUser, gender);
+	JSON_FIELD(FirstName, Dict, StoredUser, first_name);
+	JSON_FIELD(LastName, Dict, StoredUser, last_name);
+	JSON_FIELD(BirthDate, Int, StoredUser, birth_date);
+	JSON_FIELD(Email, Str, StoredUser, email);
+	typedef jsonschema::Object<Id, Gender, FirstName, LastName, BirthDate, Email> Schema;
+};
+
+struct LocationJSON {
+	JSON_FIELD(Id, Int, StoredLocation, id);
+	JSON_FIELD(Place, Dict, StoredLocation, place);
+	JSON_FIELD(City, Dict, StoredLocation, city);
+	JSON_FIELD(Country, Dict, StoredLocation, country);
+	JSON_FIELD(Distance, Int, StoredLocation, distance);
+	typedef jsonschema::Object<Id, Place, City, Country, Distance> Schema;
+};
+
+// Row of /users/<id>/visits: visit with place of its location
+struct VisitPlace {
+	int visited_at;
+	int mark;
+	uint32_t place;
+};
+
+struct VisitPlaceJSON {
+	JSON_FIELD(VisitedAt, Int, VisitPlace, visited_at);
+	JSON_FIELD(Mark, Int, VisitPlace, mark);
+	JSON_FIELD(Place, Dict, VisitPlace, place);
+	typedef jsonschema::Object<VisitedAt, Mark, Place> Schema;
+};
@@ -0,0 +1,168 @@
+#include "result_cache.h"
+#include <stdlib.h>
+#include <new>
+
+const size_t ResultCache::kVersionSlots;
+const int ResultCache::kWays;
+const size_t ResultCache::kEntryEstimate;
+const int ResultCache::kMaxEvictSteps;
+
+ResultCache::ResultCache(EpochManager &epochs) : epochs_(epochs), capacity_(0), sets_(0), bytes_(0), entries_(0), hand_(0) {
+	for (auto &c : counters_) {
+		c.hits.store(0, std::memory_order_relaxed);
+		c.misses.store(0, std::memory_order_relaxed);
+		c.stale.store(0, std::memory_order_relaxed);
+		c.evictions.store(0, std::memory_order_relaxed);
+	}
+}
+
+ResultCache::~ResultCache() { clear(); }
+
+// Frees entries of table. Nobody may use cache
+void ResultCache::clear() {
+	for (size_t i = 0; i < sets_ * kWays; i++) free(table_[i].exchange(nullptr, std::memory_order_relaxed));
+	bytes_.store(0, std::memory_order_relaxed);
+	entries_.store(0, std::memory_order_relaxed);
+}
+
+void ResultCache::SetCapacity(size_t bytes) {
+	clear();
+	capacity_ = bytes;
+	for (auto &v : versions_) {
+		if (!bytes || v) continue;
+		v.reset(new std::atomic<uint32_t>[kVersionSlots]);
+		for (size_t i = 0; i < kVersionSlots; i++) v[i].store(0, std::memory_order_relaxed);
+	}
+
+	// Power of two sets, so set of key is a mask of hash
+	sets_ = 0;
+	table_.reset();
+	if (!bytes) return;
+	sets_ = 1;
+	while (sets_ * kWays * kEntryEstimate < bytes) sets_ *= 2;
+	table_.reset(new std::atomic<Entry *>[sets_ * kWays]);
+	for (size_t i = 0; i < sets_ * kWays; i++) table_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+bool ResultCache::remove(std::atomic<Entry *> &s, Entry *e) {
+	if (!s.compare_exchange_strong(e, nullptr, std::memory_order_acq_rel)) return false;
+	bytes_.fetch_sub(e->bytes(), std::memory_order_relaxed);
+	entries_.fetch_sub(1, std::memory_order_relaxed);
+	epochs_.Retire(e);
+	return true;
+}
+
+bool ResultCache::Get(const Key &key, uint32_t version, const char *&data, size_t &len) {
+	if (!Enabled()) return false;
+	Counters &c = counters();
+	std::atomic<Entry *> *set = &table_[(hash(key) & (sets_ - 1)) * kWays];
+	for (int w = 0; w < kWays; w++) {
+		Entry *e = set[w].load(std::memory_order_acquire);
+		if (!e || !(e->key == key)) continue;
+		if (e->version != version) {
+			// Entry is rendered before the last update of entity. Entry of newer version than caller's is kept
+			if (int32_t(version - e->version) > 0) remove(set[w], e);
+			inc(c.stale);
+			break;
+		}
+		// Reference bit is written only if it's not set, so hot entries are not written by each hit
+		if (!e->used.load(std::memory_order_relaxed)) e->used.store(1, std::memory_order_relaxed);
+		data = e->data();
+		len = e->len;
+		inc(c.hits);
+		return true;
+	}
+	inc(c.misses);
+	return false;
+}
+
+void ResultCache::Put(const Key &key, uint32_t version, const char *data, size_t len) {
+	if (!Enabled() || sizeof(Entry) + len > capacity_ / kWays) return;
+	Counters &c = counters();
+	size_t h = hash(key);
+	std::atomic<Entry *> *set = &table_[(h & (sets_ - 1)) * kWays];
+
+	// Victim is slot of the same key, empty slot, stale entry, or the first entry without reference bit.
+	// Concurrent Puts of the same key may take two slots, and the one, which is not found first, is evicted later
+	int victim = -1, empty = -1, stale = -1, unused = -1;
+	Entry *cur[kWays];
+	for (int w = 0; w < kWays; w++) {
+		cur[w] = set[w].load(std::memory_order_acquire);
+		if (!cur[w]) {
+			if (empty < 0) empty = w;
+		} else if (cur[w]->key == key) {
+			// Reader, which started before the last bump, must not replace result of the newer version
+			if (int32_t(version - cur[w]->version) <= 0) return;
+			victim = w;
+			break;
+		} else if (stale < 0 && this->stale(cur[w])) {
+			stale = w;
+		}
+	}
+	if (victim < 0) victim = empty >= 0 ? empty : stale;
+	if (victim < 0) {
+		// Scan starts from way of key, so sets are not always evicted from the first way
+		int start = (h >> 32) % kWays;
+		for (int i = 0; i < kWays && unused < 0; i++) {
+			int w = (start + i) % kWays;
+			if (!cur[w]->used.load(std::memory_order_relaxed)) {
+				unused = w;
+			} else {
+				cur[w]->used.store(0, std::memory_order_relaxed);
+			}
+		}
+		// All entries were referenced, and their bits are cleared now
+		victim = unused >= 0 ? unused : start;
+	}
+
+	Entry *e = new (malloc(sizeof(Entry) + len)) Entry;
+	e->key = key;
+	e->version = version;
+	e->len = len;
+	e->used.store(0, std::memory_order_relaxed);
+	memcpy(const_cast<char *>(e->data()), data, len);
+
+	Entry *old = cur[victim];
+	// Concurrent Put of the same set won, and result of this one is just not cached
+	if (!set[victim].compare_exchange_strong(old, e, std::memory_order_acq_rel)) {
+		free(e);
+		return;
+	}
+	bytes_.fetch_add(e->bytes(), std::memory_order_relaxed);
+	entries_.fetch_add(1, std::memory_order_relaxed);
+	if (old) {
+		bytes_.fetch_sub(old->bytes(), std::memory_order_relaxed);
+		entries_.fetch_sub(1, std::memory_order_relaxed);
+		if (victim != stale && !(old->key == key)) inc(c.evictions);
+		epochs_.Retire(old);
+	}
+	if (bytes_.load(std::memory_order_relaxed) > capacity_) evict();
+}
+
+// Global clock hand sweeps the table, clearing reference bits and removing entries without them, until cache
+// is under cap. Steps are bounded, so Put does not spin, while concurrent Puts are adding
+void ResultCache::evict() {
+	Counters &c = counters();
+	size_t slots = sets_ * kWays;
+	for (int step = 0; step < kMaxEvictSteps && bytes_.load(std::memory_order_relaxed) > capacity_; step++) {
+		auto &s = table_[hand_.fetch_add(1, std::memory_order_relaxed) & (slots - 1)];
+		Entry *e = s.load(std::memory_order_acquire);
+		if (!e) continue;
+		if (e->used.load(std::memory_order_relaxed) && !stale(e)) {
+			e->used.store(0, std::memory_order_relaxed);
+			continue;
+		}
+		if (remove(s, e)) inc(c.evictions);
+	}
+}
+
+ResultCache::Stats ResultCache::GetStats() const {
+	Stats st{entries_.load(std::memory_order_relaxed), bytes_.load(std::memory_order_relaxed), 0, 0, 0, 0};
+	for (auto &c : counters_) {
+		st.hits += c.hits.load(std::memory_order_relaxed);
+		st.misses += c.misses.load(std::memory_order_relaxed);
+		st.stale += c.stale.load(std::memory_order_relaxed);
+		st.evictions += c.evictions.load(std::memory_order_relaxed);
+	}
+	return st;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include "epoch.h"
+
+// Response bodies of /users/<id>/visits and /locations/<id>/avg by id and parsed filter.
+// Each user and location has a version, which writers bump after update of store, and entry is valid
+// only while version of its entity is the one it was rendered at. So POST makes stale only entries
+// of entities, which it affects, and stale entries are dropped on lookup or replaced first by Put.
+//
+// Cache is lock free: set associative table of pointers to immutable entries, each entry with its body
+// in one allocation. Put publishes entry by CAS of slot, and replaced entry is retired to epochs, so
+// Get returns pointer to body without copy, which is valid while caller holds epoch guard.
+// Victim in full set is chosen by CLOCK: hit sets reference bit of entry, and eviction clears it.
+// Versions are striped by id over kVersionSlots counters: ids of hlcup fit, and larger ids only
+// share versions, which makes some entries stale too early, but never serves stale ones.
+class ResultCache {
+public:
+	enum Kind { KindUserVisits, KindLocationAvg, KindCount };
+
+	// Filter after parsing, so different spellings of the same filter share entry. Unused params are 0
+	struct Key {
+		int kind;
+		int id;
+		int params[5];
+
+		bool operator==(const Key &other) const { return !memcmp(this, &other, sizeof(Key)); }
+	};
+
+	struct Stats {
+		size_t entries, bytes;
+		uint64_t hits, misses, stale, evictions;
+	};
+
+	explicit ResultCache(EpochManager &epochs);
+	~ResultCache();
+	ResultCache(const ResultCache &) = delete;
+	ResultCache &operator=(const ResultCache &) = delete;
+
+	// Cap of bodies and entries in bytes, 0 disables cache. Must be set before serving.
+	// Versions and table are allocated by enabled cache and take KindCount * kVersionSlots * 4 bytes
+	// and 8 bytes per kEntryEstimate of cap above it
+	void SetCapacity(size_t bytes);
+	size_t Capacity() const { return capacity_; }
+	bool Enabled() const { return capacity_ != 0; }
+
+	// Version of entity must be taken before reading store, and passed to Get and Put of results rendered from it
+	uint32_t Version(Kind kind, int id) const {
+		return Enabled() ? versions_[kind][slot(id)].load(std::memory_order_acquire) : 0;
+	}
+	// Makes results of entity stale. Must be called after update of store is complete
+	void Bump(Kind kind, int id) {
+		if (Enabled()) versions_[kind][slot(id)].fetch_add(1, std::memory_order_release);
+	}
+
+	// Finds body of entry with actual version. Caller must hold epoch guard, and body is valid until guard ends
+	bool Get(const Key &key, uint32_t version, const char *&data, size_t &len);
+	// Inserts or replaces body, unless entry of newer version is cached already. Caller must hold epoch guard
+	void Put(const Key &key, uint32_t version, const char *data, size_t len);
+
+	Stats GetStats() const;
+
+protected:
+	static const size_t kVersionSlots = 1 << 20;
+	static const int kWays = 8;
+	// Expected bytes of entry, which give number of sets for cap
+	static const size_t kEntryEstimate = 512;
+	// Steps of global clock hand per Put over cap
+	static const int kMaxEvictSteps = 4 * kWays;
+
+	struct Entry {
+		Key key;
+		uint32_t version;
+		uint32_t len;
+		// Reference bit of CLOCK
+		std::atomic<uint8_t> used;
+		const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+		size_t bytes() const { return sizeof(Entry) + len; }
+	};
+	// Counters of thread: hits are counted without writes to shared cache lines
+	struct alignas(64) Counters {
+		std::atomic<uint64_t> hits, misses, stale, evictions;
+	};
+
+	static size_t hash(const Key &k) {
+		uint64_t h = 14695981039346656037ull;
+		const int *p = &k.kind;
+		for (size_t i = 0; i < sizeof(Key) / sizeof(int); i++) h = (h ^ uint32_t(p[i])) * 1099511628211ull;
+		return h ^ (h >> 32);
+	}
+	static size_t slot(int id) { return uint32_t(id) & (kVersionSlots - 1); }
+	static void inc(std::atomic<uint64_t> &c) { c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+	Counters &counters() { return counters_[ThreadIndex()]; }
+	bool stale(const Entry *e) const { return e->version != Version(Kind(e->key.kind), e->key.id); }
+	// Unlinks entry from slot, if it's still there. Returns false if slot was changed by other thread
+	bool remove(std::atomic<Entry *> &s, Entry *e);
+	void evict();
+	void clear();
+
+	EpochManager &epochs_;
+	size_t capacity_;
+	std::unique_ptr<std::atomic<uint32_t>[]> versions_[KindCount];
+	std::unique_ptr<std::atomic<Entry *>[]> table_;
+	size_t sets_;
+	std::atomic<size_t> bytes_, entries_, hand_;
+	Counters counters_[kMaxThreads];
+};
@@ -1,216 +1,254 @@
-
 #include "server.h"
-#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <thread>
 #include "cbinding/serializer.h"
-#include "http/listener.h"
+#include "entity_parser.h"
+#include "json_schema.h"
+#include "loader.h"
+#include "loadgen.h"
+#include "request_arena.h"
+#include "response_schemas.h"
+#include "snapshot.h"
+#include "tools/allocdebug.h"
+#include "warmup.h"
 
 using namespace reindexer;
 
-Server::Server(shared_ptr<reindexer::Reindexer> db) : db_(db) {}
+// Templates of new items: they are setting up json layout of items, values are filled by SetField
+static const string kVisitTmpl = "{\"user\": 0, \"location\": 0, \"visited_at\": 0, \"id\": 0, \"mark\": 1}";
+static const string kUserTmpl = "{\"first_name\": \"\", \"last_name\": \"\", \"birth_date\": 0, \"gender\": \"\", \"id\": 0, \"email\": \"\"}";
+static const string kLocationTmpl = "{\"distance\":0, \"city\": \"\", \"place\": \"\", \"id\": 0, \"country\": \"\"}";
+
+// Enough to absorb burst of POSTs while reindexer is busy with /query
+static const size_t kMirrorQueueSize = 1 << 16;
+static const size_t kQueryCacheSize = 1024;
+
+Server::Server(shared_ptr<reindexer::Reindexer> db)
+	: db_(db), usersJson_(store_.Epochs()), locationsJson_(store_.Epochs()), visitsJson_(store_.Epochs()), port_(0),
+	  mirrorQueue_(kMirrorQueueSize), mirrorApplied_(0), mirrorOverflows_(0), mirrorLagSum_(0), mirrorLagMax_(0),
+	  queryCache_(kQueryCacheSize), resultCache_(store_.Epochs()) {}
 Server::~Server() {}
 
-bool Server::Start(int port) {
-	ev::dynamic_loop loop;
+// Nested routes are served by handlers of entities
+static Route routeOf(Route route, http::Context &ctx) {
+	if (route == RouteGetUser && strstr(ctx.request->pathParams, "/visits")) return RouteUserVisits;
+	if (route == RouteGetLocation && strstr(ctx.request->pathParams, "/avg")) return RouteLocationAvg;
+	return route;
+}
+
+// All handlers are called via this wrapper: it feeds busy poller, records per route stats, pins epoch
+// of store, so memory replaced by concurrent writers is not freed while handler reads it, and resets
+// request arena. Heap allocations are counted by process wide counters, so they are exact only
+// while other threads are not allocating
+template <int (Server::*handler)(http::Context &), Route route>
+int Server::instrumented(http::Context &ctx) {
+	poller_.Activity();
+	auto tmStart = std::chrono::steady_clock::now();
+	size_t allocs = get_alloc_cnt_total();
+	size_t bytesIn = ctx.body ? ctx.body->Pending() : 0;
+	int ret;
+	{
+		RequestArena::Scope arena;
+		EpochManager::Guard guard(store_.Epochs());
+		ret = (this->*handler)(ctx);
+	}
+	allocs = get_alloc_cnt_total() - allocs;
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tmStart).count();
+	stats_.Record(routeOf(route, ctx), ctx.writer->RespCode(), bytesIn, ctx.writer->Written(), us, allocs);
+	return ret;
+}
 
-	router.GET<Server, &Server::GetVisits>("/visits/", this);
-	router.GET<Server, &Server::GetUsers>("/users/", this);
-	router.GET<Server, &Server::GetLocations>("/locations/", this);
-	router.POST<Server, &Server::PostVisits>("/visits/", this);
-	router.POST<Server, &Server::PostUsers>("/users/", this);
-	router.POST<Server, &Server::PostLocations>("/locations/", this);
-	router.GET<Server, &Server::GetQuery>("/query", this);
-	//	router.enableStats();
+// Pins calling thread
+static void pinThread(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+		logPrintf(LogWarning, "Can't pin loop thread to cpu %d", cpu);
+	}
+}
 
-	http::Listener listener(loop, router, 4);
+bool Server::Start(int port, int threads, bool pinCpus, bool reusePort) {
+	router.GET<Server, &Server::instrumented<&Server::GetVisits, RouteGetVisit>>("/visits/", this);
+	router.GET<Server, &Server::instrumented<&Server::GetUsers, RouteGetUser>>("/users/", this);
+	router.GET<Server, &Server::instrumented<&Server::GetLocations, RouteGetLocation>>("/locations/", this);
+	router.POST<Server, &Server::instrumented<&Server::PostVisits, RoutePostVisit>>("/visits/", this);
+	router.POST<Server, &Server::instrumented<&Server::PostUsers, RoutePostUser>>("/users/", this);
+	router.POST<Server, &Server::instrumented<&Server::PostLocations, RoutePostLocation>>("/locations/", this);
+	router.GET<Server, &Server::instrumented<&Server::GetQuery, RouteQuery>>("/query", this);
+	router.GET<Server, &Server::instrumented<&Server::GetStats, RouteStats>>("/stats", this);
+
+	port_ = port;
+	threads = std::max(1, threads);
+	listener_.reset(new http::Listener(router));
+	listener_->SetBusyPoll([this]() { return poller_.Spinning(); });
+	listener_->SetWakeupLatency([this](uint64_t us) { poller_.Wakeup(us); });
+	listener_->SetReusePort(reusePort);
+	// Each loop pins own thread, loop 0 runs in this thread and gets the first cpu
+	if (pinCpus) {
+		int ncpu = std::max(1, int(sysconf(_SC_NPROCESSORS_ONLN)));
+		listener_->SetThreadStart([ncpu](int loop) { pinThread(loop % ncpu); });
+	}
 
-	if (!listener.Bind(port)) {
+	if (!listener_->Bind(port)) {
 		printf("Can't listen on %d port\n", port);
 		return false;
 	}
-	listener.Fork(3);
+	// Each loop thread has own event loop and accepts from own SO_REUSEPORT socket or from the shared one.
+	// All of them share store and db
+	listener_->Fork(threads - 1);
+	if (reusePort && listener_->Sockets() < threads) {
+		int shared = threads - listener_->Sockets() + 1;
+		logPrintf(LogWarning, "SO_REUSEPORT is not available, %d of %d loops share accept socket", shared, threads);
+	}
+	logPrintf(LogInfo, "Listening on %d port with %d loop threads, %d sockets%s", port, threads, listener_->Sockets(),
+			  pinCpus ? ", pinned to cpus" : "");
+
+	startMirrorApplier();
+	startBusyPoller();
 
 	mlockall(MCL_CURRENT);
 	signal(SIGPIPE, SIG_IGN);
 
-	listener.Run();
+	listener_->Run();
 	printf("listener::Run exited\n");
 
 	return true;
 }
 
-int Server::GetVisits(http::Context &ctx) {
-	char *p;
-	int id = strtol(ctx.request->pathParams, &p, 10);
+// Responses are rendered to request arena of loop thread
+static void renderBody(const PackedVisit &visit, const StringDict &dict, ArenaString &out) {
+	jsonschema::Render<VisitJSON::Schema>(visit.Unpack(), dict, out);
+}
+static void renderBody(const StoredUser &user, const StringDict &dict, ArenaString &out) {
+	jsonschema::Render<UserJSON::Schema>(user, dict, out);
+}
+static void renderBody(const StoredLocation &location, const StringDict &dict, ArenaString &out) {
+	jsonschema::Render<LocationJSON::Schema>(location, dict, out);
+}
 
-	QueryResults res;
-	auto q = Query("visits").Where("id", CondEq, id);
+// Re-renders cached body of just updated entity
+template <typename T>
+static void rerender(RenderCache &cache, const StringDict &dict, const T *rec) {
+	if (!rec) return;
+	ArenaString body{ArenaAllocator<char>(RequestArena::Local())};
+	renderBody(*rec, dict, body);
+	cache.Put(rec->id, body.data(), body.size());
+}
 
-#ifndef CUSTOM_JSON
-	q.Select({"id", "location", "user", "visited_at", "mark"});
-#endif
-	auto ret = db_->Select(q, res);
-	if (!ret.ok() || res.size() != 1) {
-		return ctx.CString(http::StatusNotFound, ret.what().data());
+// Sends cached body of entity, rendering it on first request
+template <typename T>
+static int sendRendered(http::Context &ctx, RenderCache &cache, const StringDict &dict, const T &rec) {
+	auto body = cache.Get(rec.id);
+	if (!body) {
+		ArenaString rendered{ArenaAllocator<char>(RequestArena::Local())};
+		renderBody(rec, dict, rendered);
+		body = cache.Fill(rec.id, rendered.data(), rendered.size());
 	}
+	return ctx.JSON(http::StatusOK, body.data, body.len);
+}
 
-	WrSerializer wrSer(true);
-
-#ifdef CUSTOM_JSON
-	auto &type = *res.ctxs[0].type_;
-	ConstPayload pl(type, &res[0].data);
-	wrSer.PutChars("{\"id\":");
-	wrSer.Print((int)pl.Field(1).Get());  // id
-	wrSer.PutChars(",\"user\":");
-	wrSer.Print((int)pl.Field(2).Get());  // user
-	wrSer.PutChars(",\"location\":");
-	wrSer.Print((int)pl.Field(3).Get());  // location
-	wrSer.PutChars(",\"visited_at\":");
-	wrSer.Print((int)pl.Field(4).Get());  // visited_at
-	wrSer.PutChars(",\"mark\":");
-	wrSer.Print((int)pl.Field(5).Get());  // mark
-	wrSer.PutChars("}");
-#else
-	res.GetJSON(0, wrSer, false);
-#endif
+int Server::GetVisits(http::Context &ctx) {
+	char *p;
+	int id = strtol(ctx.request->pathParams, &p, 10);
 
-	return ctx.JSON(http::StatusOK, wrSer.Buf(), wrSer.Len());
+	auto visit = store_.GetVisit(id);
+	if (!visit) {
+		return ctx.CString(http::StatusNotFound, "");
+	}
+	return sendRendered(ctx, visitsJson_, store_.Dict(), *visit);
 }
 
 int Server::GetUsers(http::Context &ctx) {
 	char *p = nullptr;
 	int id = strtol(ctx.request->pathParams, &p, 10);
 
-	QueryResults res;
-	auto q = Query("users").Where("id", CondEq, id);
-	auto ret = db_->Select(q, res);
-	if (!ret.ok() || res.size() != 1) {
-		return ctx.CString(http::StatusNotFound, ret.what().data());
+	auto user = store_.GetUser(id);
+	if (!user) {
+		return ctx.CString(http::StatusNotFound, "");
 	}
 	if (!strcmp(p, "/visits")) {
 		return GetUserVisits(ctx);
 	}
-
-	WrSerializer wrSer(true);
-#ifdef CUSTOM_JSON
-	ConstPayload pl(*res.ctxs[0].type_, &res[0].data);
-	wrSer.PutChars("{\"id\":");
-	wrSer.Print((int)pl.Field(1).Get());  // id
-	wrSer.PutChars(",\"gender\":\"");
-	wrSer.PutChars(p_string(pl.Field(2).Get()).data());  // gender
-	wrSer.PutChars("\",\"first_name\":\"");
-	wrSer.PutChars(p_string(pl.Field(3).Get()).data());  // first_name
-	wrSer.PutChars("\",\"last_name\":\"");
-	wrSer.PutChars(p_string(pl.Field(4).Get()).data());  // last_name
-	wrSer.PutChars("\",\"birth_date\":");
-	wrSer.Print((int)pl.Field(5).Get());  // birth_date
-	wrSer.PutChars(",\"email\":\"");
-	wrSer.PutChars(p_string(pl.Field(6).Get()).data());  // email
-	wrSer.PutChars("\"}");
-#else
-	res.GetJSON(0, wrSer, false);
-#endif
-	return ctx.JSON(http::StatusOK, wrSer.Buf(), wrSer.Len());
+	return sendRendered(ctx, usersJson_, store_.Dict(), *user);
 }
 
 int Server::GetLocations(http::Context &ctx) {
 	char *p = nullptr;
 	int id = strtol(ctx.request->pathParams, &p, 10);
 
-	QueryResults res;
-	auto ret = db_->Select(Query("locations").Where("id", CondEq, id), res);
-	if (!ret.ok() || res.size() != 1) {
-		return ctx.CString(http::StatusNotFound, ret.what().data());
+	auto location = store_.GetLocation(id);
+	if (!location) {
+		return ctx.CString(http::StatusNotFound, "");
 	}
 	if (!strcmp(p, "/avg")) {
 		return GetLocationAvg(ctx);
 	}
-
-	WrSerializer wrSer(true);
-
-#ifdef CUSTOM_JSON
-	ConstPayload pl(*res.ctxs[0].type_, &res[0].data);
-	wrSer.PutChars("{\"id\":");
-	wrSer.Print((int)pl.Field(1).Get());  // id
-	wrSer.PutChars(",\"place\":\"");
-	wrSer.PutChars(p_string(pl.Field(2).Get()).data());  // place
-	wrSer.PutChars("\",\"city\":\"");
-	wrSer.PutChars(p_string(pl.Field(3).Get()).data());  // city
-	wrSer.PutChars("\",\"country\":\"");
-	wrSer.PutChars(p_string(pl.Field(4).Get()).data());  // country
-	wrSer.PutChars("\",\"distance\":");
-	wrSer.Print((int)pl.Field(5).Get());  // distance
-	wrSer.PutChars("}");
-#else
-	res.GetJSON(0, wrSer, false);
-#endif
-	return ctx.JSON(http::StatusOK, wrSer.Buf(), wrSer.Len());
+	return sendRendered(ctx, locationsJson_, store_.Dict(), *location);
 }
 
 int Server::GetUserVisits(http::Context &ctx) {
 	char *pend;
 	int userid = strtol(ctx.request->pathParams, &pend, 10);
 
-	QueryResults res;
-	auto q = Query("visits").Where("user", CondEq, userid).Sort("visited_at", false);
+	// Country is compared by dictionary code. Unknown country has no code, and matches nothing
+	bool byCountry = false;
+	uint32_t country = StringDict::kNotFound;
+	int toDistance = INT_MAX, fromDate = INT_MIN, toDate = INT_MAX;
 
-#ifndef CUSTOM_JSON
-	q.Select({"mark", "place", "visited_at"});
-#endif
 	for (auto p : ctx.request->params) {
 		int intval = strtol(p.val, &pend, 10);
 		if (!strcmp(p.name, "country")) {
-			q.Where("country", CondEq, p.val);
+			byCountry = true;
+			country = store_.Dict().Find(p.val);
 		} else if (!strcmp(p.name, "toDistance") && *p.val) {
 			if (*pend) {
 				return ctx.CString(http::StatusBadRequest, "Can't convert distance to number");
 			}
-			q.Where("distance", CondLt, intval);
+			toDistance = intval;
 		} else if (!strcmp(p.name, "fromDate") && *p.val) {
 			if (*pend) {
 				return ctx.CString(http::StatusBadRequest, "Can't convert fromDate to number");
 			}
-			q.Where("visited_at", CondGt, intval);
+			fromDate = intval;
 		} else if (!strcmp(p.name, "toDate") && *p.val) {
 			if (*pend) {
 				return ctx.CString(http::StatusBadRequest, "Can't convert toDate to number");
 			}
-			q.Where("visited_at", CondLt, intval);
+			toDate = intval;
 		}
 	}
 
-	auto ret = db_->Select(q, res);
-	if (!ret.ok()) {
-		return ctx.CString(http::StatusBadRequest, ret.what().data());
+	ResultCache::Key key{ResultCache::KindUserVisits, userid, {fromDate, toDate, toDistance, byCountry, int(country)}};
+	uint32_t version = resultCache_.Version(ResultCache::KindUserVisits, userid);
+	const char *cached;
+	size_t cachedLen;
+	if (resultCache_.Get(key, version, cached, cachedLen)) {
+		return ctx.JSON(http::StatusOK, cached, cachedLen);
 	}
 
-	WrSerializer wrSer(true);
-	wrSer.PutChars("{\"visits\":[");
-
-	for (size_t i = 0; i < res.size(); i++) {
-		if (i != 0) {
-			wrSer.PutChar(',');
+	ArenaString body{ArenaAllocator<char>(RequestArena::Local())};
+	ArenaVector<VisitPlace> rows{ArenaAllocator<VisitPlace>(RequestArena::Local())};
+	auto timeline = store_.GetUserVisits(userid);
+	if (timeline) {
+		auto begin = timeline->LowerBound(fromDate), end = timeline->UpperBound(toDate);
+		rows.reserve(std::max(end - begin, decltype(end - begin)(0)));
+		for (auto v = begin; v < end; v++) {
+			auto location = store_.GetLocation(v->LocationId());
+			if (!location || location->distance >= toDistance || (byCountry && location->country != country)) {
+				continue;
+			}
+			rows.push_back(VisitPlace{v->visited_at, v->Mark(), location->place});
 		}
-#ifdef CUSTOM_JSON
-		auto &type = *res.ctxs[0].type_;
-		ConstPayload pl(type, &res[i].data);
-		wrSer.PutChars("{\"visited_at\":");
-		wrSer.Print((int)pl.Field(4).Get());  // visited_at
-		wrSer.PutChars(",\"mark\":");
-		wrSer.Print((int)pl.Field(5).Get());  // mark
-		wrSer.PutChars(",\"place\":\"");
-		wrSer.PutChars(p_string(pl.Field(8).Get()).data());  // place
-		wrSer.PutChars("\"}");
-#else
-		res.GetJSON(i, wrSer, false);
-#endif
-	}
-	wrSer.PutChars("]}");
-	return ctx.JSON(http::StatusOK, wrSer.Buf(), wrSer.Len());
+	}
+	jsonschema::RenderList<VisitPlaceJSON::Schema>("{\"visits\":[", rows.data(), rows.data() + rows.size(), store_.Dict(), body);
+	resultCache_.Put(key, version, body.data(), body.size());
+	return ctx.JSON(http::StatusOK, body.data(), body.size());
 }
 
 int years2unix(int age) { return age * 365 * 60 * 60 * 24 + ((age + 3) / 4 * 60 * 60 * 24); }
@@ -220,8 +258,7 @@ int Server::GetLocationAvg(http::Context &ctx) {
 	char *pend;
 	int locationid = strtol(ctx.request->pathParams, &pend, 10);
 
-	QueryResults res;
-	auto q = Query("visits").Where("location", CondEq, locationid).Aggregate("mark", AggAvg);
+	AvgFilter filter{INT_MIN, INT_MAX, INT_MIN, INT_MAX, 0};
 
 	for (auto p : ctx.request->params) {
 		int intval = strtol(p.val, &pend, 10);
@@ -229,274 +266,565 @@ int Server::GetLocationAvg(http::Context &ctx) {
 			if (*pend) {
 				return ctx.CString(http::StatusBadRequest, "Can't convert fromDate to number");
 			}
-			q.Where("visited_at", CondGt, intval);
+			filter.fromDate = intval;
 		} else if (!strcmp(p.name, "toDate") && *p.val) {
 			if (*pend) {
 				return ctx.CString(http::StatusBadRequest, "Can't convert toDate to number");
 			}
-			q.Where("visited_at", CondLt, intval);
+			filter.toDate = intval;
 		} else if (!strcmp(p.name, "gender") && *p.val) {
 			if (strcmp(p.val, "f") && strcmp(p.val, "m")) {
 				return ctx.CString(http::StatusBadRequest, "Invalid gender value");
 			}
-			q.Where("gender", CondEq, p.val);
+			filter.gender = *p.val;
 		} else if (!strcmp(p.name, "fromAge") && *p.val) {
 			if (*pend) {
-				ctx.CString(http::StatusBadRequest, "Invalid fromAge value");
+				return ctx.CString(http::StatusBadRequest, "Invalid fromAge value");
 			}
-			q.Where("birth_date", CondLt, fakeNow_ - years2unix(intval));
+			filter.toBirthDate = fakeNow_ - years2unix(intval);
 		} else if (!strcmp(p.name, "toAge") && *p.val) {
 			if (*pend) {
 				return ctx.CString(http::StatusBadRequest, "Invalid toAge value");
 			}
-			q.Where("birth_date", CondGt, fakeNow_ - years2unix(intval));
+			filter.fromBirthDate = fakeNow_ - years2unix(intval);
 		}
 	}
 
-	auto ret = db_->Select(q, res);
-	if (!ret.ok()) {
-		return ctx.CString(http::StatusBadRequest, ret.what().data());
+	ResultCache::Key key{ResultCache::KindLocationAvg,
+						 locationid,
+						 {filter.fromDate, filter.toDate, filter.fromBirthDate, filter.toBirthDate, filter.gender}};
+	uint32_t version = resultCache_.Version(ResultCache::KindLocationAvg, locationid);
+	const char *cached;
+	size_t cachedLen;
+	if (resultCache_.Get(key, version, cached, cachedLen)) {
+		return ctx.JSON(http::StatusOK, cached, cachedLen);
+	}
+
+	int64_t sum = 0;
+	int count = 0;
+	auto visits = store_.GetLocationVisits(locationid);
+	if (visits) {
+		visits->Aggregate(filter, sum, count);
 	}
 
 	char tmpBuf[256];
-	int l = snprintf(tmpBuf, sizeof(tmpBuf), "{\"avg\":%g}", roundup(res.aggregationResults[0]));
+	int l = snprintf(tmpBuf, sizeof(tmpBuf), "{\"avg\":%g}", roundup(count ? double(sum) / count : 0));
+	resultCache_.Put(key, version, tmpBuf, l);
 	return ctx.JSON(http::StatusOK, tmpBuf, l);
 }
 
+// /query answers at most kQueryMaxRows rows, and stops serialization after kQueryTimeBudget, or when client
+// does not read response as fast as it's written, so ad-hoc queries can't stall loop thread for long or pin
+// output memory. The rest of results is paged by `cursor` from `next` of response
+static const unsigned kQueryMaxRows = 10000;
+static const auto kQueryTimeBudget = std::chrono::milliseconds(20);
+// Rows are written by batches: each write of response with unknown length is sent as one http chunk
+static const size_t kQueryBatchSize = 16 << 10;
+
+// Removes whitespace, which does not change meaning of sql: leading, trailing and repeated outside of quotes
+static void normalizeSQL(const char *sql, ArenaString &out) {
+	char quote = 0;
+	for (const char *p = sql; *p; p++) {
+		if (quote) {
+			if (*p == '\\' && p[1]) {
+				out += *p++;
+			} else if (*p == quote) {
+				quote = 0;
+			}
+		} else if (*p == '\'' || *p == '"') {
+			quote = *p;
+		} else if (isspace(uint8_t(*p))) {
+			if (!out.empty() && p[1] && !isspace(uint8_t(p[1]))) out += ' ';
+			continue;
+		}
+		out += *p;
+	}
+}
+
 int Server::GetQuery(http::Context &ctx) {
-	reindexer::QueryResults res;
 	const char *sqlQuery = nullptr;
+	unsigned limit = kQueryMaxRows, cursor = 0;
 
 	for (auto p : ctx.request->params) {
-		if (!strcmp(p.name, "q")) sqlQuery = p.val;
+		char *pend;
+		if (!strcmp(p.name, "q")) {
+			sqlQuery = p.val;
+		} else if (!strcmp(p.name, "limit")) {
+			long val = strtol(p.val, &pend, 10);
+			if (*pend || val <= 0) {
+				return ctx.CString(http::StatusBadRequest, "Invalid limit value");
+			}
+			limit = unsigned(std::min(val, long(kQueryMaxRows)));
+		} else if (!strcmp(p.name, "cursor")) {
+			long val = strtol(p.val, &pend, 10);
+			if (*pend || val < 0 || val > INT_MAX) {
+				return ctx.CString(http::StatusBadRequest, "Invalid cursor value");
+			}
+			cursor = val;
+		}
 	}
 
 	if (!sqlQuery) {
 		return ctx.CString(http::StatusBadRequest, "Missed `q` parameter");
 	}
 
-	auto ret = db_->Select(sqlQuery, res);
+	// Parsed queries are cached, and each call just sets the page to it
+	ArenaString key{ArenaAllocator<char>(RequestArena::Local())};
+	key.reserve(strlen(sqlQuery));
+	normalizeSQL(sqlQuery, key);
+	Query q("");
+	if (!queryCache_.Get(key.data(), key.size(), q)) {
+		auto tmStart = std::chrono::steady_clock::now();
+		try {
+			q.Parse(sqlQuery);
+		} catch (const Error &err) {
+			return ctx.CString(http::StatusBadRequest, err.what().data());
+		}
+		stats_.Time(TimerParse, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tmStart).count());
+		queryCache_.Put(key.data(), key.size(), q);
+	}
+
+	// Page is selected inside of limit and offset of sql query, with one extra row to know if there are more
+	if (q.count != UINT_MAX && q.count <= cursor) {
+		return ctx.JSON(http::StatusOK, "{\"items\":[]}", 12);
+	}
+	unsigned left = q.count == UINT_MAX ? UINT_MAX : q.count - cursor;
+	q.start += cursor;
+	q.count = std::min(left, limit + 1);
+
+	reindexer::QueryResults res;
+	auto tmStart = std::chrono::steady_clock::now();
+	auto ret = db_->Select(q, res);
+	auto tmSelected = std::chrono::steady_clock::now();
+	stats_.Time(TimerSelect, std::chrono::duration_cast<std::chrono::microseconds>(tmSelected - tmStart).count());
 
 	if (!ret.ok()) {
 		return ctx.CString(http::StatusInternalServerError, ret.what().data());
 	}
 	ctx.writer->SetRespCode(http::StatusOK);
-	reindexer::WrSerializer wrSer(true);
-	ctx.writer->Write("{\"items\":[", 10);
-	for (size_t i = 0; i < res.size(); i++) {
-		wrSer.Reset();
+	// Serializer of loop thread keeps its buffer, which is bounded by batch size, between requests
+	static thread_local reindexer::WrSerializer wrSer(true);
+	wrSer.Reset();
+	wrSer.PutChars("{\"items\":[");
+	size_t rows = std::min(res.size(), size_t(limit)), i = 0;
+	auto deadline = tmSelected + kQueryTimeBudget;
+	while (i < rows) {
 		if (i != 0) {
-			ctx.writer->Write(",", 1);
+			wrSer.PutChar(',');
 		}
-		res.GetJSON(i, wrSer, false);
-		ctx.writer->Write(wrSer.Buf(), wrSer.Len());
+		res.GetJSON(i++, wrSer, false);
+		if (wrSer.Len() >= kQueryBatchSize) {
+			ctx.writer->Write(wrSer.Buf(), wrSer.Len());
+			wrSer.Reset();
+			if (ctx.writer->Congested() || std::chrono::steady_clock::now() > deadline) break;
+		}
+	}
+	wrSer.PutChar(']');
+	if (i < res.size()) {
+		wrSer.PutChars(",\"next\":");
+		wrSer.Print(cursor + i);
 	}
-	ctx.writer->Write("]}", 2);
+	wrSer.PutChar('}');
+	ctx.writer->Write(wrSer.Buf(), wrSer.Len());
+	stats_.Time(TimerSerialize,
+				std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tmSelected).count());
 	return 0;
 }
 
-int Server::PostVisits(http::Context &ctx) {
-	int id = -1;
-	char *p = nullptr;
-	if (strcmp(ctx.request->pathParams, "new")) {
-		id = strtol(ctx.request->pathParams, &p, 10);
+static size_t rssBytes() {
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f) return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(f);
+	return size_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+int Server::GetStats(http::Context &ctx) {
+	string out = "{";
+	stats_.GetJSON(out);
+	char tmpBuf[256];
+	snprintf(tmpBuf, sizeof(tmpBuf),
+			 ",\"mirror_queue\":%d,\"mirror_overflows\":%d,\"rss_mb\":%d,\"store_mb\":%d,\"render_cache_mb\":%d,\"retired\":%d",
+			 int(mirrorQueue_.Size()), int(mirrorOverflows_.load()), int(rssBytes() >> 20), int(store_.MemUsage() >> 20),
+			 int((usersJson_.MemUsage() + locationsJson_.MemUsage() + visitsJson_.MemUsage()) >> 20), int(store_.Epochs().Pending()));
+	out += tmpBuf;
+	// Each hit saves a parse, so saved time is estimated by mean time of parses on misses
+	snprintf(tmpBuf, sizeof(tmpBuf), ",\"query_cache\":{\"size\":%d,\"hits\":%llu,\"misses\":%llu,\"parse_saved_ms\":%llu}",
+			 int(queryCache_.Size()), (unsigned long long)queryCache_.Hits(), (unsigned long long)queryCache_.Misses(),
+			 (unsigned long long)(queryCache_.Hits() * stats_.MeanTime(TimerParse) / 1000));
+	out += tmpBuf;
+	// Stale are misses of entries, which were made stale by POSTs
+	auto rc = resultCache_.GetStats();
+	snprintf(tmpBuf, sizeof(tmpBuf),
+			 ",\"result_cache\":{\"entries\":%d,\"mb\":%d,\"cap_mb\":%d,\"hits\":%llu,\"misses\":%llu,\"stale\":%llu,"
+			 "\"evictions\":%llu,\"hit_rate\":%.3f}",
+			 int(rc.entries), int(rc.bytes >> 20), int(resultCache_.Capacity() >> 20), (unsigned long long)rc.hits,
+			 (unsigned long long)rc.misses, (unsigned long long)rc.stale, (unsigned long long)rc.evictions,
+			 double(rc.hits) / std::max(rc.hits + rc.misses, uint64_t(1)));
+	out += tmpBuf;
+	// Socket syscalls per request show how well reads and writes of pipelined requests are batched
+	auto io = listener_->GetStats();
+	snprintf(tmpBuf, sizeof(tmpBuf),
+			 ",\"io_syscalls\":{\"read\":%llu,\"write\":%llu,\"accept\":%llu,\"requests\":%llu,\"per_request\":%.2f}",
+			 (unsigned long long)io.reads, (unsigned long long)io.writes, (unsigned long long)io.accepts, (unsigned long long)io.requests,
+			 double(io.reads + io.writes) / std::max(io.requests, uint64_t(1)));
+	out += tmpBuf;
+	out += '}';
+	return ctx.JSON(http::StatusOK, out.data(), out.size());
+}
+
+// Hlcup entities are below 1KB, so larger body is a broken or malicious request
+static const size_t kMaxBodySize = 16 << 10;
+
+// Reads the whole body of POST request to buf of kMaxBodySize + 1 bytes, and zero terminates it.
+// Body must be consumed even if request is rejected: with keep-alive the rest of it would be read as the next request.
+// Returns 0 or http status of error, then connection must be closed
+static int readBody(http::Context &ctx, char *buf, size_t &len) {
+	len = 0;
+	while (size_t pending = ctx.body->Pending()) {
+		if (len + pending > kMaxBodySize) {
+			return http::StatusRequestEntityTooLarge;
+		}
+		ssize_t nread = ctx.body->Read(buf + len, pending);
+		if (nread <= 0) {
+			return http::StatusBadRequest;
+		}
+		len += nread;
 	}
+	buf[len] = 0;
+	return 0;
+}
 
-	ctx.writer->SetConnectionClose();
+// Parses body in place, without heap allocations. Parsed strings are referencing body
+template <typename T>
+static bool parseBody(char *body, size_t len, bool (*parse)(char *&, const char *, T &, unsigned &), T &rec, unsigned &fields) {
+	char *p = body;
+	return len && parse(p, body + len, rec, fields);
+}
 
-	lock_guard<mutex> lock(lockVisits_);
-	unique_ptr<Item> item;
-	string jsonTmpl("{\"user\": 0, \"location\": 0, \"visited_at\": 0, \"id\": 0, \"mark\": 1, \"place\":\"\"}");
+// Id from path of POST request, or -1 for /new
+static int postId(http::Context &ctx) {
+	if (!strcmp(ctx.request->pathParams, "new")) {
+		return -1;
+	}
+	return strtol(ctx.request->pathParams, nullptr, 10);
+}
+
+static uint64_t nowMs() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// POST handlers are updating store (and so all GET indexes) synchronously,
+// and reindexer namespaces, which are serving /query, asynchronously via mirror queue.
+// Connections are kept alive: body is always read completely before response
+int Server::PostVisits(http::Context &ctx) {
+	int id = postId(ctx);
+
+	char body[kMaxBodySize + 1];
+	size_t len;
+	if (int status = readBody(ctx, body, len)) {
+		ctx.writer->SetConnectionClose();
+		return ctx.CString(status, "");
+	}
 
+	lock_guard<mutex> lock(lockVisits_);
+	Visit visit{-1, 0, 0, 0, 1};
 	if (id >= 0) {
-		QueryResults res;
-		auto ret = db_->Select(Query("visits").Where("id", CondEq, id), res);
-		if (!ret.ok() || res.size() != 1) {
-			return ctx.CString(http::StatusNotFound, ret.what().data());
+		auto old = store_.GetVisit(id);
+		if (!old) {
+			return ctx.CString(http::StatusNotFound, "");
 		}
-		item.reset(db_->GetItem("visits", res[0].id));
-		item->Clone();
-	} else {
-		item.reset(db_->NewItem("visits"));
-		item->FromJSON(jsonTmpl);
+		visit = old->Unpack();
 	}
-
-	JsonAllocator jallocator;
-	char *body = (char *)alloca(ctx.body->Pending() + 1);
-	if (!parseBodyToObject(ctx, item.get(), jallocator, body)) {
-		return ctx.CString(http::StatusBadRequest, "Can't parse json or null field in json");
+	Visit before = visit;
+	// New entity must have all the fields
+	unsigned fields = 0;
+	if (!parseBody(body, len, ParseVisit, visit, fields) || (id < 0 && fields != kVisitFields)) {
+		return ctx.CString(http::StatusBadRequest, "Can't parse json, null or missed field in json");
 	}
-
 	if (id >= 0) {
-		item->SetField("id", (KeyRef)id);
-	} else {
-		id = (int)item->GetField("id");
+		visit.id = id;
 	}
-	updatedVisits_.push_back(id);
 
-	db_->Upsert("visits", item.get());
-	lastUpdated_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	if (!store_.PutVisit(visit)) {
+		return ctx.CString(http::StatusBadRequest, "Can't store visit");
+	}
+	rerender(visitsJson_, store_.Dict(), store_.GetVisit(visit.id));
+	// Visit may be moved to other user or location, then results of both old and new ones are stale
+	resultCache_.Bump(ResultCache::KindUserVisits, visit.user);
+	resultCache_.Bump(ResultCache::KindLocationAvg, visit.location);
+	if (id >= 0) {
+		if (before.user != visit.user) resultCache_.Bump(ResultCache::KindUserVisits, before.user);
+		if (before.location != visit.location) resultCache_.Bump(ResultCache::KindLocationAvg, before.location);
+	}
+	mirror(MirrorUpdate::KindVisit, visit.id);
+	lastUpdated_ = nowMs();
 
 	return ctx.JSON(http::StatusOK, "{}", 2);
 }
 
 int Server::PostUsers(http::Context &ctx) {
-	int id = -1;
-	char *p = nullptr;
-	if (strcmp(ctx.request->pathParams, "new")) {
-		id = strtol(ctx.request->pathParams, &p, 10);
-	}
+	int id = postId(ctx);
 
-	ctx.writer->SetConnectionClose();
+	char body[kMaxBodySize + 1];
+	size_t len;
+	if (int status = readBody(ctx, body, len)) {
+		ctx.writer->SetConnectionClose();
+		return ctx.CString(status, "");
+	}
 
 	lock_guard<mutex> lock(lockUsers_);
-
-	unique_ptr<Item> item;
-	string jsonTmpl("{\"first_name\": \"\", \"last_name\": \"\", \"birth_date\": 0, \"gender\": \"\", \"id\": 0, \"email\": \"\"}");
-
+	User user{-1, 0, "", "", "", ""};
 	if (id >= 0) {
-		QueryResults res;
-		auto ret = db_->Select(Query("users").Where("id", CondEq, id), res);
-		if (!ret.ok() || res.size() != 1) {
-			return ctx.CString(http::StatusNotFound, ret.what().data());
+		auto old = store_.GetUser(id);
+		if (!old) {
+			return ctx.CString(http::StatusNotFound, "");
 		}
-		item.reset(db_->GetItem("users", res[0].id));
-		item->Clone();
-	} else {
-		item.reset(db_->NewItem("users"));
-		item->FromJSON(jsonTmpl);
+		user = store_.Decode(*old);
 	}
-	JsonAllocator jallocator;
-	char *body = (char *)alloca(ctx.body->Pending() + 1);
-	if (!parseBodyToObject(ctx, item.get(), jallocator, body)) {
-		return ctx.CString(http::StatusBadRequest, "Can't parse json or null field in json");
+	User before = user;
+	// New entity must have all the fields
+	unsigned fields = 0;
+	if (!parseBody(body, len, ParseUser, user, fields) || (id < 0 && fields != kUserFields)) {
+		return ctx.CString(http::StatusBadRequest, "Can't parse json, null or missed field in json");
 	}
 	if (id >= 0) {
-		item->SetField("id", (KeyRef)id);
-	} else {
-		id = (int)item->GetField("id");
+		user.id = id;
 	}
-	updatedUsers_.push_back(id);
 
-	db_->Upsert("users", item.get());
-	lastUpdated_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	// Store copies strings, so they may reference body buffer
+	if (!store_.PutUser(user)) {
+		return ctx.CString(http::StatusBadRequest, "Can't store user");
+	}
+	rerender(usersJson_, store_.Dict(), store_.GetUser(user.id));
+	// Avg of locations is filtered by birth date and gender of visitors. Other fields of user are not in results.
+	// New user may have visits already, which were counted without its attributes
+	if (id < 0 || before.birth_date != user.birth_date || strcmp(before.gender, user.gender)) {
+		if (auto timeline = store_.GetUserVisits(user.id)) {
+			for (auto &v : *timeline) resultCache_.Bump(ResultCache::KindLocationAvg, v.LocationId());
+		}
+	}
+	mirror(MirrorUpdate::KindUser, user.id);
+	lastUpdated_ = nowMs();
 
 	return ctx.JSON(http::StatusOK, "{}", 2);
 }
 
 int Server::PostLocations(http::Context &ctx) {
-	int id = -1;
-	char *p = nullptr;
-	if (strcmp(ctx.request->pathParams, "new")) {
-		id = strtol(ctx.request->pathParams, &p, 10);
-	}
+	int id = postId(ctx);
 
-	ctx.writer->SetConnectionClose();
+	char body[kMaxBodySize + 1];
+	size_t len;
+	if (int status = readBody(ctx, body, len)) {
+		ctx.writer->SetConnectionClose();
+		return ctx.CString(status, "");
+	}
 
 	lock_guard<mutex> lock(lockLocations_);
-	unique_ptr<Item> item;
-	string jsonTmpl("{\"distance\":0, \"city\": \"\", \"place\": \"\", \"id\": 0, \"country\": \"\"}");
-
+	Location location{-1, 0, "", "", ""};
 	if (id >= 0) {
-		QueryResults res;
-		auto ret = db_->Select(Query("locations").Where("id", CondEq, id), res);
-		if (!ret.ok() || res.size() != 1) {
-			return ctx.CString(http::StatusNotFound, ret.what().data());
+		auto old = store_.GetLocation(id);
+		if (!old) {
+			return ctx.CString(http::StatusNotFound, "");
 		}
-		item.reset(db_->GetItem("locations", res[0].id));
-		item->Clone();
-	} else {
-		item.reset(db_->NewItem("locations"));
-		item->FromJSON(jsonTmpl);
+		location = store_.Decode(*old);
 	}
-
-	JsonAllocator jallocator;
-	char *body = (char *)alloca(ctx.body->Pending() + 1);
-	if (!parseBodyToObject(ctx, item.get(), jallocator, body)) {
-		return ctx.CString(http::StatusBadRequest, "Can't parse json or null field in json");
+	Location before = location;
+	// New entity must have all the fields
+	unsigned fields = 0;
+	if (!parseBody(body, len, ParseLocation, location, fields) || (id < 0 && fields != kLocationFields)) {
+		return ctx.CString(http::StatusBadRequest, "Can't parse json, null or missed field in json");
 	}
 	if (id >= 0) {
-		item->SetField("id", (KeyRef)id);
-	} else {
-		id = (int)item->GetField("id");
+		location.id = id;
+	}
+
+	if (!store_.PutLocation(location)) {
+		return ctx.CString(http::StatusBadRequest, "Can't store location");
+	}
+	rerender(locationsJson_, store_.Dict(), store_.GetLocation(location.id));
+	// Visits of users are filtered by distance and country of location, and rendered with its place.
+	// Visits of new location may be posted already, and they were skipped in results of users
+	if (id < 0 || before.distance != location.distance || strcmp(before.place, location.place) ||
+		strcmp(before.country, location.country)) {
+		if (auto visits = store_.GetLocationVisits(location.id)) {
+			for (int i = 0; i < visits->size; i++) {
+				if (auto v = store_.GetVisit(visits->VisitId()[i])) resultCache_.Bump(ResultCache::KindUserVisits, v->UserId());
+			}
+		}
 	}
-	updatedLocations_.push_back(id);
+	mirror(MirrorUpdate::KindLocation, location.id);
+	lastUpdated_ = nowMs();
 
-	db_->Upsert("locations", item.get());
-	lastUpdated_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 	return ctx.JSON(http::StatusOK, "{}", 2);
 }
 
-void Server::mergeVisit(Item *visit) {
-	QueryResults res1, res2;
+static void setFields(Item *it, const User &u) {
+	it->SetField("id", KeyRef(u.id));
+	it->SetField("gender", KeyRef(p_string(u.gender)));
+	it->SetField("first_name", KeyRef(p_string(u.first_name)));
+	it->SetField("last_name", KeyRef(p_string(u.last_name)));
+	it->SetField("birth_date", KeyRef(u.birth_date));
+	it->SetField("email", KeyRef(p_string(u.email)));
+}
 
-	auto ret = db_->Select(Query("users").Where("id", CondEq, visit->GetField("user")), res1);
-	if (!ret.ok() || res1.size() != 1) {
-		abort();
-	}
-	unique_ptr<Item> user(db_->GetItem("users", res1[0].id));
+static void setFields(Item *it, const Location &l) {
+	it->SetField("id", KeyRef(l.id));
+	it->SetField("place", KeyRef(p_string(l.place)));
+	it->SetField("city", KeyRef(p_string(l.city)));
+	it->SetField("country", KeyRef(p_string(l.country)));
+	it->SetField("distance", KeyRef(l.distance));
+}
 
-	ret = db_->Select(Query("locations").Where("id", CondEq, visit->GetField("location")), res2);
-	if (!ret.ok() || res2.size() != 1) {
-		abort();
-	}
-	unique_ptr<Item> location(db_->GetItem("locations", res2[0].id));
+static void setFields(Item *it, const Visit &v) {
+	it->SetField("id", KeyRef(v.id));
+	it->SetField("user", KeyRef(v.user));
+	it->SetField("location", KeyRef(v.location));
+	it->SetField("visited_at", KeyRef(v.visited_at));
+	it->SetField("mark", KeyRef(v.mark));
+}
 
-	visit->SetField("distance", location->GetField("distance"));
-	visit->SetField("place", location->GetField("place"));
-	visit->SetField("country", location->GetField("country"));
-	visit->SetField("gender", user->GetField("gender"));
-	visit->SetField("birth_date", user->GetField("birth_date"));
+template <typename T>
+static void upsertRecord(Reindexer *db, const char *ns, const string &tmpl, const T &rec) {
+	unique_ptr<Item> it(db->NewItem(ns));
+	it->FromJSON(tmpl);
+	setFields(it.get(), rec);
+	db->Upsert(ns, it.get());
+}
 
-	// int64_t visited_at = (int)visit->GetField("visited_at");
-	// visit->SetField("visited_at_loc", KeyRef((visited_at << 32ULL) + (int)visit->GetField("location")));
-	// visit->SetField("visited_at_user", KeyRef((visited_at << 32ULL) + (int)visit->GetField("user")));
+void Server::mirror(MirrorUpdate::Kind kind, int id) {
+	MirrorUpdate upd{kind, id, std::chrono::steady_clock::now()};
+	if (!mirrorQueue_.Push(upd)) {
+		// Applier is too far behind. Don't block, but don't lose update too
+		mirrorOverflows_++;
+		applyMirror(upd);
+	}
 }
 
-void Server::updateVisits() {
-	if (!updatedVisits_.size() && updatedUsers_.size() && !updatedUsers_.size()) {
-		return;
+// Copies the latest state of record from store to reindexer. Updates of the same record are idempotent,
+// so it is safe to apply them in any order, as long as read and upsert are not interleaved.
+// Caller holds epoch guard of store: handler on overflow of queue, or applier thread
+void Server::applyMirror(const MirrorUpdate &upd) {
+	lock_guard<mutex> lock(lockMirror_);
+	auto tmStart = std::chrono::steady_clock::now();
+	switch (upd.kind) {
+		case MirrorUpdate::KindUser:
+			if (auto u = store_.GetUser(upd.id)) upsertRecord(db_.get(), "users", kUserTmpl, store_.Decode(*u));
+			break;
+		case MirrorUpdate::KindLocation:
+			if (auto l = store_.GetLocation(upd.id)) upsertRecord(db_.get(), "locations", kLocationTmpl, store_.Decode(*l));
+			break;
+		case MirrorUpdate::KindVisit:
+			if (auto v = store_.GetVisit(upd.id)) upsertRecord(db_.get(), "visits", kVisitTmpl, v->Unpack());
+			break;
 	}
+	auto tmEnd = std::chrono::steady_clock::now();
+	stats_.Time(TimerMirrorApply, std::chrono::duration_cast<std::chrono::microseconds>(tmEnd - tmStart).count());
+	auto lag = std::chrono::duration_cast<std::chrono::microseconds>(tmEnd - upd.tm).count();
+	mirrorApplied_++;
+	mirrorLagSum_ += lag;
+	if (uint64_t(lag) > mirrorLagMax_) mirrorLagMax_ = lag;
+}
 
-	auto q = Query("visits")
-				 .Where("id", CondSet, updatedVisits_)
-				 .Or()
-				 .Where("user", CondSet, updatedUsers_)
-				 .Or()
-				 .Where("location", CondSet, updatedLocations_);
+void Server::startMirrorApplier() {
+	auto th = new std::thread([&]() {
+		uint64_t lastPrint = nowMs();
+		for (;;) {
+			MirrorUpdate upd;
+			if (mirrorQueue_.Pop(upd)) {
+				EpochManager::Guard guard(store_.Epochs());
+				applyMirror(upd);
+			} else {
+				usleep(1000);
+			}
 
-	logPrintf(LogInfo, "Updating visits");
-	QueryResults res;
-	auto ret = db_->Select(q, res);
-	if (!ret.ok()) {
-		abort();
-	}
-	logPrintf(LogInfo, "Got %d visits for update", res.size());
-	for (auto r : res) {
-		unique_ptr<Item> visit(db_->GetItem("visits", r.id));
-		visit->Clone();
-		mergeVisit(visit.get());
-		db_->Upsert("visits", visit.get());
-	}
-	logPrintf(LogInfo, "Done update visits");
-	updatedVisits_.clear();
-	updatedUsers_.clear();
-	updatedLocations_.clear();
+			uint64_t now = nowMs();
+			if (now - lastPrint > 2000) {
+				uint64_t applied = mirrorApplied_.exchange(0), lagSum = mirrorLagSum_.exchange(0), lagMax = mirrorLagMax_.exchange(0);
+				if (applied) {
+					logPrintf(LogInfo, "Mirror: applied %d, queued %d, overflows %d, lag avg %dus, max %dus", int(applied),
+							  int(mirrorQueue_.Size()), int(mirrorOverflows_.load()), int(lagSum / applied), int(lagMax));
+				}
+				lastPrint = now;
+			}
+		}
+	});
+	th->detach();
 }
 
-bool Server::LoadData(const string &dataDir) {
+bool Server::LoadData(const string &dataDir, const string &snapshotPath) {
 	dataDir_ = dataDir;
-	bool ret = loadUsers();
-	ret = ret && loadLocations();
-	ret = ret && loadVisits();
+	uint64_t signature = DataSignature(dataDir_);
+	bool ret = createNamespaces();
+
+	std::shared_ptr<Snapshot> snapshot(new Snapshot);
+	bool fromSnapshot = ret && snapshot->Open(snapshotPath, signature);
+	if (fromSnapshot) {
+		// Store serves all the GET requests, so it's enough to start. Namespaces for /query are filled in background
+		auto tmStart = std::chrono::steady_clock::now();
+		ret = store_.Load(snapshot->Users(), snapshot->Locations(), snapshot->Visits());
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tmStart).count();
+		logPrintf(LogInfo, "Store loaded from snapshot %s in %dms, memory usage %dMB", snapshotPath.c_str(), int(ms),
+				  int(store_.MemUsage() >> 20));
+		if (ret) fillNamespacesAsync(snapshot);
+	} else {
+		// Loaded records are shared with background writer of snapshot, and are freed after it
+		std::shared_ptr<BulkLoader> loader(new BulkLoader(dataDir_));
+		ret = ret && loader->Load();
+
+		// Namespaces and store are independent, so fill them concurrently
+		bool usersOk = false, locationsOk = false, storeOk = false;
+		auto user = [](const User &u, User &out) { return out = u, true; };
+		auto location = [](const Location &l, Location &out) { return out = l, true; };
+		auto visit = [](const Visit &v, Visit &out) { return out = v, true; };
+		std::thread usersTh([&]() { usersOk = ret && fillNamespace("users", kUserTmpl, loader->Users(), user, nullptr); });
+		std::thread locationsTh(
+			[&]() { locationsOk = ret && fillNamespace("locations", kLocationTmpl, loader->Locations(), location, nullptr); });
+		std::thread storeTh([&]() {
+			auto tmStart = std::chrono::steady_clock::now();
+			storeOk = ret && store_.Load(loader->Users(), loader->Locations(), loader->Visits());
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tmStart).count();
+			logPrintf(LogInfo, "Store loaded in %dms, memory usage %dMB", int(ms), int(store_.MemUsage() >> 20));
+		});
+		ret = ret && fillNamespace("visits", kVisitTmpl, loader->Visits(), visit, nullptr);
+		usersTh.join();
+		locationsTh.join();
+		storeTh.join();
+		ret = ret && usersOk && locationsOk && storeOk;
+
+		// Snapshot only speeds up the next start, so server does not wait for it
+		if (ret) writeSnapshotAsync(loader, snapshotPath, signature);
+	}
+
 	ret = ret && loadOptions();
-	lastUpdated_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	logPrintf(LogInfo, "Data loaded, RSS %dMB, tables of store are backed by %s pages", int(rssBytes() >> 20),
+			  HugePagesName(store_.TablesBacking()));
+	probeStore("cold");
+	// Namespaces from snapshot are warmed up after they are filled
+	if (ret && !fromSnapshot) warmupNamespaces();
+	lastUpdated_ = nowMs();
 	startWarmupRoutine();
 	return ret;
 }
 
+void Server::writeSnapshotAsync(std::shared_ptr<BulkLoader> loader, const string &path, uint64_t signature) {
+	std::thread([loader, path, signature]() {
+		auto tmStart = std::chrono::steady_clock::now();
+		if (Snapshot::Write(path, signature, loader->Users(), loader->Locations(), loader->Visits())) {
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tmStart).count();
+			logPrintf(LogInfo, "Snapshot %s written in background in %dms", path.c_str(), int(ms));
+		}
+	}).detach();
+}
+
+static void logInserted(const char *ns, size_t count, std::chrono::steady_clock::time_point tmStart) {
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tmStart).count();
+	logPrintf(LogInfo, "Inserted %d %s in %dms (%d obj/sec)", int(count), ns, int(ms), int(count * 1000 / std::max(ms, decltype(ms)(1))));
+}
+
 IndexOpts oppk{0, 1};
-bool Server::loadUsers() {
+bool Server::createNamespaces() {
 	db_->AddNamespace("users");
 	db_->AddIndex("users", "id", "id", IndexIntHash, &oppk);
 	db_->AddIndex("users", "gender", "gender", IndexStrStore);
@@ -504,39 +832,75 @@ bool Server::loadUsers() {
 	db_->AddIndex("users", "last_name", "last_name", IndexStrStore);
 	db_->AddIndex("users", "birth_date", "birth_date", IndexIntStore);
 	db_->AddIndex("users", "email", "email", IndexStrStore);
-	return findFilesAndLoadToDB("users", "users");
-}
 
-bool Server::loadLocations() {
 	db_->AddNamespace("locations");
 	db_->AddIndex("locations", "id", "id", IndexIntHash, &oppk);
 	db_->AddIndex("locations", "place", "place", IndexStrStore);
 	db_->AddIndex("locations", "city", "city", IndexStrStore);
 	db_->AddIndex("locations", "country", "country", IndexStrStore);
 	db_->AddIndex("locations", "distance", "distance", IndexIntStore);
-	return findFilesAndLoadToDB("locations", "locations");
-}
 
-bool Server::loadVisits() {
+	// Visits keep only foreign keys: attributes of users and locations are joined on read from store
 	db_->AddNamespace("visits");
 	db_->AddIndex("visits", "id", "id", IndexIntHash, &oppk);
 	db_->AddIndex("visits", "user", "user", IndexIntHash);
 	db_->AddIndex("visits", "location", "location", IndexIntHash);
 	db_->AddIndex("visits", "visited_at", "visited_at", IndexInt);
-
 	db_->AddIndex("visits", "mark", "mark", IndexIntStore);
-	db_->AddIndex("visits", "distance", "distance", IndexIntStore);
-	db_->AddIndex("visits", "country", "country", IndexHash);
-	db_->AddIndex("visits", "place", "place", IndexStrStore);
-	db_->AddIndex("visits", "gender", "gender", IndexStrStore);
-	db_->AddIndex("visits", "birth_date", "birth_date", IndexIntStore);
+	return true;
+}
 
-	// OOM for this cool indexes :(
-	// db_->AddIndex("visits", "visited_at+location", "", IndexComposite);
-	// db_->AddIndex("visits", "visited_at_loc", "visited_at_loc", IndexInt64);
-	// db_->AddIndex("visits", "visited_at_user", "visited_at_user", IndexInt64);
+// Inserts records to namespace. `latest` sets record to insert for loaded one, or returns false to skip it.
+// With mutex each record is read and inserted under it, so fill does not race with mirror applier
+template <typename T, typename F>
+bool Server::fillNamespace(const char *ns, const string &tmpl, const vector<T> &recs, F latest, mutex *mtx) {
+	auto tmStart = std::chrono::steady_clock::now();
+	unique_ptr<Item> it(db_->NewItem(ns));
+	it->FromJSON(tmpl);
+	for (auto &rec : recs) {
+		std::unique_lock<mutex> lock;
+		if (mtx) lock = std::unique_lock<mutex>(*mtx);
+		T r;
+		if (!latest(rec, r)) continue;
+		it->Clone();
+		setFields(it.get(), r);
+		if (!db_->Upsert(ns, it.get()).ok()) return false;
+	}
+	logInserted(ns, recs.size(), tmStart);
+	return true;
+}
 
-	return findFilesAndLoadToDB("visits", "visits");
+// Records may be already updated by POSTs, so the latest versions are taken from store.
+// Each record is copied under own epoch guard, so the long fill does not hold back reclamation
+void Server::fillNamespacesAsync(std::shared_ptr<Snapshot> snapshot) {
+	auto th = new std::thread([this, snapshot]() {
+		auto tmStart = std::chrono::steady_clock::now();
+		auto user = [this](const User &u, User &out) {
+			EpochManager::Guard guard(store_.Epochs());
+			auto stored = store_.GetUser(u.id);
+			if (stored) out = store_.Decode(*stored);
+			return stored != nullptr;
+		};
+		auto location = [this](const Location &l, Location &out) {
+			EpochManager::Guard guard(store_.Epochs());
+			auto stored = store_.GetLocation(l.id);
+			if (stored) out = store_.Decode(*stored);
+			return stored != nullptr;
+		};
+		auto visit = [this](const Visit &v, Visit &out) {
+			EpochManager::Guard guard(store_.Epochs());
+			auto stored = store_.GetVisit(v.id);
+			if (stored) out = stored->Unpack();
+			return stored != nullptr;
+		};
+		bool ok = fillNamespace("users", kUserTmpl, snapshot->Users(), user, &lockMirror_) &&
+				  fillNamespace("locations", kLocationTmpl, snapshot->Locations(), location, &lockMirror_) &&
+				  fillNamespace("visits", kVisitTmpl, snapshot->Visits(), visit, &lockMirror_);
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tmStart).count();
+		logPrintf(ok ? LogInfo : LogError, "Namespaces are filled from snapshot in %dms%s", int(ms), ok ? "" : " with errors");
+		if (ok) warmupNamespaces();
+	});
+	th->detach();
 }
 
 vector<char> loadFile(const char *path) {
@@ -570,104 +934,135 @@ bool Server::loadOptions() {
 	return true;
 }
 
-bool Server::findFilesAndLoadToDB(const char *name, const char *ns) {
-	size_t len = strlen(name);
-	DIR *dirp = opendir(dataDir_.c_str());
-	dirent *dp;
-
-	while ((dp = readdir(dirp)) != nullptr) {
-		if (strlen(dp->d_name) < len || strncmp(dp->d_name, name, len)) continue;
+static const uint64_t kPollerTickUs = 1000;
 
-		auto data = loadFile((dataDir_ + "/" + dp->d_name).c_str());
-		logPrintf(LogInfo, "Loadind %s(%d) bytes", dp->d_name, (int)data.size());
-
-		unique_ptr<reindexer::Item> it(db_->NewItem(ns));
-		for (char *end = &data.at(1), *beg = strchr(end, '{'); beg; beg = strchr(end, '{')) {
-			end = strchr(beg, '}') + 1;
-			*end++ = 0;
-			char tmpBuf[2048];
-
-			if (!strcmp(ns, "visits")) {
-				strcpy(tmpBuf, beg);
-				strcpy(tmpBuf + (end - beg) - 2, ",\"place\":\"\"}");
-				it->FromJSON(Slice(tmpBuf, strlen(tmpBuf) + 1));
-				mergeVisit(it.get());
-			} else {
-				it->FromJSON(Slice(beg, end - beg));
-			}
-			auto res = db_->Upsert(ns, it.get());
-			if (!res.ok()) {
-				abort();
+void Server::startBusyPoller() {
+	auto th = new std::thread([&]() {
+		uint64_t lastPrint = nowMs();
+		for (;;) {
+			usleep(kPollerTickUs);
+			poller_.Tick();
+
+			uint64_t now = nowMs();
+			if (now - lastPrint > 2000) {
+				auto st = poller_.TakeStats();
+				if (st.spins || st.spinTimeUs) {
+					int spinPercent = int(st.spinTimeUs * 100 / std::max(st.spinTimeUs + st.parkTimeUs, uint64_t(1)));
+					logPrintf(LogInfo, "Poller: spin %d%% of time, %d spins, %d parks, %d wakeups, window %dus, wakeup %dus (max %dus)",
+							  spinPercent, int(st.spins), int(st.parks), int(st.wakeups), int(st.windowUs), int(st.wakeLatencyUs),
+							  int(st.wakeLatencyMaxUs));
+				}
+				lastPrint = now;
 			}
 		}
-	}
-	closedir(dirp);
-	return true;
+	});
+	th->detach();
 }
 
-bool Server::parseBodyToObject(http::Context &ctx, Item *item, JsonAllocator &jallocator, char *body) {
-	char *pend = nullptr;
-	ssize_t nread = ctx.body->Read(body, ctx.body->Pending());
-	body[nread] = 0;
-
-	if (nread == 0) {
-		return false;
+static const int kWarmupRequests = 50000;
+static const int kWarmupConnections = 100;
+static const int kProbeReads = 100000;
+
+// Selects, which force all lazy work of reindexer: filters by columns without index match nothing, but scan
+// payloads of all items; lookups by hash indexes and sort by tree index build them. Each pass is timed,
+// and the second pass shows latency of the first requests after warmup
+void Server::warmupNamespaces() {
+	static const struct {
+		const char *ns, *field;
+		int value;
+		CondType cond;
+	} kFilters[] = {
+		{"users", "birth_date", INT_MIN, CondEq},
+		{"locations", "distance", -1, CondEq},
+		{"visits", "mark", -1, CondEq},
+		{"users", "id", 1, CondEq},
+		{"locations", "id", 1, CondEq},
+		{"visits", "id", 1, CondEq},
+		{"visits", "user", 1, CondEq},
+		{"visits", "location", 1, CondEq},
+		{"visits", "visited_at", 0, CondGt},
+	};
+	uint64_t passUs[2];
+	for (auto &us : passUs) {
+		auto tmStart = std::chrono::steady_clock::now();
+		for (auto &f : kFilters) {
+			QueryResults res;
+			db_->Select(Query(f.ns).Where(f.field, f.cond, f.value).Limit(1), res);
+		}
+		QueryResults res;
+		db_->Select(Query("visits").Sort("visited_at", false).Limit(1), res);
+		us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tmStart).count();
 	}
+	logPrintf(LogInfo, "Namespaces warmed up in %dms, warm pass of the same selects took %dus", int(passUs[0] / 1000), int(passUs[1]));
+}
 
-	JsonValue jvalue;
-	int status = jsonParse(body, &pend, &jvalue, jallocator);
-
-	if (status != JSON_OK) {
-		return false;
-	}
+void Server::probeStore(const char *stage) {
+	StoreProbe probe = ProbeStore(store_, kProbeReads, rand());
+	char tlb[32] = "n/a";
+	if (probe.tlbMissesPerRead >= 0) snprintf(tlb, sizeof(tlb), "%.2f", probe.tlbMissesPerRead);
+	logPrintf(LogInfo, "Store probe %s: %.2fus per read, %s dTLB misses per read", stage, probe.usPerRead, tlb);
+}
 
-	for (auto elem : jvalue) {
-		switch (elem->value.getTag()) {
-			case JSON_NUMBER:
-				item->SetField(elem->key, KeyRef((int)elem->value.toNumber()));
+// Mix of GET requests like in hlcup phases: entities, user visits and location averages, with and without filters
+static vector<Ammo> warmupAmmo(const Store &store, int count) {
+	static const char *kCountries[] = {"", "&country=%D0%A0%D0%BE%D1%81%D1%81%D0%B8%D1%8F", "&toDistance=50"};
+	static const char *kAvgFilters[] = {"", "&gender=m", "&gender=f&fromAge=20", "&toAge=40&fromDate=1000000000"};
+	int users = std::max(1, int(store.UsersCount())), locations = std::max(1, int(store.LocationsCount())),
+		visits = std::max(1, int(store.VisitsCount()));
+	vector<Ammo> ammo;
+	ammo.reserve(count);
+	char path[256];
+	for (int i = 0; i < count; i++) {
+		switch (i % 5) {
+			case 0:
+				snprintf(path, sizeof(path), "/users/%d", 1 + rand() % users);
 				break;
-			case JSON_STRING:
-				if (strlen(elem->value.toString())) {
-					item->SetField(elem->key, KeyRef(p_string(elem->value.toString())));
-				}
+			case 1:
+				snprintf(path, sizeof(path), "/locations/%d", 1 + rand() % locations);
+				break;
+			case 2:
+				snprintf(path, sizeof(path), "/visits/%d", 1 + rand() % visits);
+				break;
+			case 3:
+				snprintf(path, sizeof(path), "/users/%d/visits?query_id=%d%s", 1 + rand() % users, i, kCountries[rand() % 3]);
+				break;
+			case 4:
+				snprintf(path, sizeof(path), "/locations/%d/avg?query_id=%d%s", 1 + rand() % locations, i, kAvgFilters[rand() % 4]);
 				break;
-			case JSON_NULL:
-			default:
-				return false;
 		}
+		ammo.push_back(MakeGetAmmo(path));
 	}
-	return true;
+	return ammo;
 }
 
 void Server::startWarmupRoutine() {
 	auto th = new std::thread([&]() {
 		int cnt = 0;
 		for (;;) {
-			uint64_t now =
-				std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-			if (lastUpdated_ != 0 && now - lastUpdated_ > 1000) {
-				ev::gEnableBusyLoop = false;
-				QueryResults res;
-				updateVisits();
-				cnt++;
-				logPrintf(LogInfo, "Start warming up");
-				db_->Select(Query("visits").Sort("visited_at", false).Limit(1), res);
-				logPrintf(LogInfo, "Finish warming up %d", cnt);
+			uint64_t now = nowMs();
+			if (cnt < 2 && lastUpdated_ != 0 && now - lastUpdated_ > 1000) {
+				{
+					// Updates drop lazily built indexes, so they are rebuilt after each phase of updates
+					BusyPoller::Pause pause(poller_);
+					cnt++;
+					logPrintf(LogInfo, "Start warming up");
+					warmupNamespaces();
+					logPrintf(LogInfo, "Finish warming up %d", cnt);
+				}
 				lastUpdated_ = 0;
-				ev::gEnableBusyLoop = true;
 				if (cnt == 1) {
-					logPrintf(LogInfo, "Running wrk");
-					int ret = system("wrk -d1s -t1 -c1000 http://127.0.0.1/");
-					logPrintf(LogInfo, "Wrk finished, ret = %d,err=%d", ret, errno);
+					logPrintf(LogInfo, "Running warmup load");
+					LoadGen gen(LoadGen::Options{"127.0.0.1", port_, kWarmupConnections, 0, 1});
+					if (gen.Run(warmupAmmo(store_, kWarmupRequests))) {
+						gen.Report(stderr);
+					} else {
+						logPrintf(LogWarning, "Can't connect to port %d for warmup", port_);
+					}
+					probeStore("warm");
 				}
-				if (cnt == 2) {
-					return;
-				}
-			}
-			if (now - lastPrintStats_ > 2000) {
-				if (lastPrintStats_ != 0) router.printStats();
-				lastPrintStats_ = now;
 			}
+			// Garbage is collected all the time: there may be more updates after warmup phases
+			store_.CollectGarbage();
 
 			usleep(100000);
 		}
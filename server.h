@@ -1,22 +1,40 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <mutex>
+#include "bounded_queue.h"
+#include "busy_poller.h"
 #include "core/reindexer.h"
-#include "http/router.h"
+#include "http_server.h"
+#include "lru_cache.h"
+#include "render_cache.h"
+#include "result_cache.h"
+#include "stats.h"
+#include "store.h"
 
-class JsonAllocator;
-using namespace reindexer_server;
+class BulkLoader;
+class Snapshot;
 using namespace reindexer;
 using std::mutex;
 
+// Record changed by POST, which must be copied from store to reindexer namespace
+struct MirrorUpdate {
+	enum Kind { KindUser, KindLocation, KindVisit } kind;
+	int id;
+	std::chrono::steady_clock::time_point tm;
+};
+
 class Server {
 public:
 	Server(shared_ptr<reindexer::Reindexer> db);
 	~Server();
 
-	bool Start(int port);
-	bool LoadData(const string &dir);
+	bool Start(int port, int threads, bool pinCpus, bool reusePort);
+	bool LoadData(const string &dir, const string &snapshotPath);
+	void SetHugePages(HugePages mode) { store_.SetHugePages(mode); }
+	// Size cap of cached /users/<id>/visits and /locations/<id>/avg responses, 0 disables cache
+	void SetResultCache(size_t bytes) { resultCache_.SetCapacity(bytes); }
 
 	int GetVisits(http::Context &ctx);
 	int GetUsers(http::Context &ctx);
@@ -29,23 +47,41 @@ public:
 	int PostLocations(http::Context &ctx);
 
 	int GetQuery(http::Context &ctx);
+	int GetStats(http::Context &ctx);
 
 protected:
-	bool parseBodyToObject(http::Context &ctx, reindexer::Item *item, JsonAllocator &jallocator, char *body);
-	void mergeVisit(Item *visit);
-	bool loadUsers();
-	bool loadLocations();
-	bool loadVisits();
+	template <int (Server::*handler)(http::Context &), Route route>
+	int instrumented(http::Context &ctx);
+	void mirror(MirrorUpdate::Kind kind, int id);
+	void applyMirror(const MirrorUpdate &upd);
+	void startMirrorApplier();
+	void startBusyPoller();
+	bool createNamespaces();
+	template <typename T, typename F>
+	bool fillNamespace(const char *ns, const string &tmpl, const vector<T> &recs, F latest, mutex *mtx);
+	void fillNamespacesAsync(std::shared_ptr<Snapshot> snapshot);
+	void writeSnapshotAsync(std::shared_ptr<BulkLoader> loader, const string &path, uint64_t signature);
 	bool loadOptions();
-	bool findFilesAndLoadToDB(const char *name, const char *ns);
+	void warmupNamespaces();
+	void probeStore(const char *stage);
 	void startWarmupRoutine();
-	void updateVisits();
 
 	shared_ptr<reindexer::Reindexer> db_;
+	Store store_;
+	RenderCache usersJson_, locationsJson_, visitsJson_;
 	string dataDir_;
+	int port_;
 	int fakeNow_;
-	std::atomic<uint64_t> lastUpdated_, lastPrintStats_;
-	vector<int> updatedVisits_, updatedUsers_, updatedLocations_;
-	mutex lockVisits_, lockUsers_, lockLocations_;
+	std::atomic<uint64_t> lastUpdated_;
+	mutex lockVisits_, lockUsers_, lockLocations_, lockMirror_;
+	BoundedQueue<MirrorUpdate> mirrorQueue_;
+	BusyPoller poller_;
+	ServerStats stats_;
+	std::atomic<uint64_t> mirrorApplied_, mirrorOverflows_, mirrorLagSum_, mirrorLagMax_;
+	// Parsed queries of /query by normalized sql
+	LruCache<reindexer::Query> queryCache_;
+	// Responses of /users/<id>/visits and /locations/<id>/avg, made stale by POSTs of entities they depend on
+	ResultCache resultCache_;
 	http::Router router;
+	std::unique_ptr<http::Listener> listener_;
 };
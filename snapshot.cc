@@ -0,0 +1,179 @@
+
+#include "snapshot.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tools/logger.h"
+
+using namespace reindexer;
+using std::string;
+using std::vector;
+
+static const char kMagic[8] = {'H', 'L', 'C', 'S', 'N', 'A', 'P', 0};
+
+struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t users, locations, visits;
+	uint64_t signature;
+	uint64_t stringsSize;
+	uint64_t checksum;
+};
+
+// Strings are offsets in strings section
+struct UserRec {
+	int32_t id, birth_date;
+	uint32_t gender, first_name, last_name, email;
+};
+
+struct LocationRec {
+	int32_t id, distance;
+	uint32_t place, city, country;
+};
+
+static_assert(sizeof(Visit) == 20, "Visits are written as is");
+
+static uint64_t hash64(uint64_t h, uint64_t v) {
+	h = (h ^ v) * 0x100000001B3ULL;
+	return h ^ (h >> 29);
+}
+
+// Four independent lanes to not be bound by latency of multiplication
+static uint64_t checksum(const char *p, size_t n) {
+	uint64_t lanes[4] = {1, 2, 3, 4};
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		uint64_t w[4];
+		memcpy(w, p + i, sizeof(w));
+		for (int l = 0; l < 4; l++) lanes[l] = hash64(lanes[l], w[l]);
+	}
+	uint64_t h = hash64(hash64(hash64(lanes[0], lanes[1]), lanes[2]), lanes[3]);
+	for (; i < n; i++) h = hash64(h, uint8_t(p[i]));
+	return hash64(h, n);
+}
+
+uint64_t DataSignature(const string &dir) {
+	DIR *dirp = opendir(dir.c_str());
+	if (!dirp) return 0;
+
+	// Sum of hashes of files does not depend on order of directory entries
+	uint64_t sig = 0;
+	dirent *dp;
+	while ((dp = readdir(dirp)) != nullptr) {
+		struct stat st;
+		if (dp->d_name[0] == '.' || stat((dir + "/" + dp->d_name).c_str(), &st) < 0) continue;
+		uint64_t h = hash64(hash64(0, st.st_size), st.st_mtime);
+		for (const char *p = dp->d_name; *p; p++) h = hash64(h, uint8_t(*p));
+		sig += h;
+	}
+	closedir(dirp);
+	return sig;
+}
+
+bool Snapshot::Write(const string &path, uint64_t signature, const vector<User> &users, const vector<Location> &locations,
+					 const vector<Visit> &visits) {
+	string tmpPath = path + ".tmp";
+	FILE *f = fopen(tmpPath.c_str(), "wb");
+	if (!f) {
+		logPrintf(LogWarning, "Can't create snapshot %s", tmpPath.c_str());
+		return false;
+	}
+
+	Header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, kMagic, sizeof(kMagic));
+	hdr.version = kVersion;
+	hdr.users = users.size();
+	hdr.locations = locations.size();
+	hdr.visits = visits.size();
+	hdr.signature = signature;
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+	// Strings are written after records in the same order, as their offsets are assigned
+	auto offset = [&hdr](const char *s) {
+		uint32_t off = hdr.stringsSize;
+		hdr.stringsSize += strlen(s) + 1;
+		return off;
+	};
+	for (auto &u : users) {
+		UserRec rec{u.id, u.birth_date, offset(u.gender), offset(u.first_name), offset(u.last_name), offset(u.email)};
+		ok = ok && fwrite(&rec, sizeof(rec), 1, f) == 1;
+	}
+	for (auto &l : locations) {
+		LocationRec rec{l.id, l.distance, offset(l.place), offset(l.city), offset(l.country)};
+		ok = ok && fwrite(&rec, sizeof(rec), 1, f) == 1;
+	}
+	ok = ok && fwrite(visits.data(), sizeof(Visit), visits.size(), f) == visits.size();
+	auto putString = [f](const char *s) { return fwrite(s, strlen(s) + 1, 1, f) == 1; };
+	for (auto &u : users) {
+		ok = ok && putString(u.gender) && putString(u.first_name) && putString(u.last_name) && putString(u.email);
+	}
+	for (auto &l : locations) {
+		ok = ok && putString(l.place) && putString(l.city) && putString(l.country);
+	}
+	ok = fclose(f) == 0 && ok;
+
+	// Checksum is calculated over written file, so it covers exactly what will be read
+	if (ok) {
+		MappedFile file;
+		ok = file.Open(tmpPath);
+		if (ok) hdr.checksum = checksum(file.Data() + sizeof(hdr), file.Size() - sizeof(hdr));
+	}
+	if (ok) {
+		f = fopen(tmpPath.c_str(), "r+b");
+		ok = f && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+		ok = f && fclose(f) == 0 && ok;
+	}
+	if (!ok || rename(tmpPath.c_str(), path.c_str()) < 0) {
+		logPrintf(LogWarning, "Can't write snapshot %s", path.c_str());
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Snapshot::Open(const string &path, uint64_t signature) {
+	if (access(path.c_str(), R_OK) < 0 || !file_.Open(path)) return false;
+
+	Header hdr;
+	if (file_.Size() < sizeof(hdr)) return false;
+	memcpy(&hdr, file_.Data(), sizeof(hdr));
+	if (memcmp(hdr.magic, kMagic, sizeof(kMagic)) || hdr.version != kVersion) {
+		logPrintf(LogInfo, "Snapshot %s has other format, ignoring it", path.c_str());
+		return false;
+	}
+	if (hdr.signature != signature) {
+		logPrintf(LogInfo, "Snapshot %s is made from other data, ignoring it", path.c_str());
+		return false;
+	}
+
+	size_t recordsSize = hdr.users * sizeof(UserRec) + hdr.locations * sizeof(LocationRec) + hdr.visits * sizeof(Visit);
+	if (file_.Size() != sizeof(hdr) + recordsSize + hdr.stringsSize ||
+		checksum(file_.Data() + sizeof(hdr), file_.Size() - sizeof(hdr)) != hdr.checksum) {
+		logPrintf(LogError, "Snapshot %s is corrupted, ignoring it", path.c_str());
+		return false;
+	}
+
+	const char *p = file_.Data() + sizeof(hdr);
+	const char *strings = p + recordsSize;
+	// Offsets are trusted: checksum matched, and writer produced them from the same strings section
+	users_.resize(hdr.users);
+	for (auto &u : users_) {
+		UserRec rec;
+		memcpy(&rec, p, sizeof(rec));
+		p += sizeof(rec);
+		u = User{rec.id, rec.birth_date, strings + rec.gender, strings + rec.first_name, strings + rec.last_name, strings + rec.email};
+	}
+	locations_.resize(hdr.locations);
+	for (auto &l : locations_) {
+		LocationRec rec;
+		memcpy(&rec, p, sizeof(rec));
+		p += sizeof(rec);
+		l = Location{rec.id, rec.distance, strings + rec.place, strings + rec.city, strings + rec.country};
+	}
+	visits_.resize(hdr.visits);
+	if (hdr.visits) memcpy(visits_.data(), p, hdr.visits * sizeof(Visit));
+	return true;
+}
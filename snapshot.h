@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "entities.h"
+#include "loader.h"
+
+// Binary snapshot of loaded entities, which replaces parsing of json data on restart.
+// Layout: header, user and location records with string offsets, visit records, and zero terminated strings.
+// Snapshot is bound to the data it was made from by signature of data files, and payload is guarded by checksum.
+class Snapshot {
+public:
+	static const uint32_t kVersion = 1;
+
+	// Writes snapshot to path atomically: to temporary file, which is renamed on success
+	static bool Write(const std::string &path, uint64_t signature, const std::vector<User> &users, const std::vector<Location> &locations,
+					  const std::vector<Visit> &visits);
+
+	// Maps snapshot. Returns false if it is missing, has other version or signature, or is corrupted
+	bool Open(const std::string &path, uint64_t signature);
+
+	// Records are referencing strings inside mapped file, so snapshot must outlive them
+	const std::vector<User> &Users() const { return users_; }
+	const std::vector<Location> &Locations() const { return locations_; }
+	const std::vector<Visit> &Visits() const { return visits_; }
+
+protected:
+	MappedFile file_;
+	std::vector<User> users_;
+	std::vector<Location> locations_;
+	std::vector<Visit> visits_;
+};
+
+// Signature of json data files in dir: names, sizes and modification times
+uint64_t DataSignature(const std::string &dir);
@@ -0,0 +1,126 @@
+
+#include "stats.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <algorithm>
+
+// Slot of thread. There is one stats instance per process, so slot is not tied to instance
+static thread_local int tlsWorker = -1;
+
+ServerStats::ServerStats() : nextWorker_(0), started_(std::chrono::steady_clock::now()) {
+	for (auto &w : workers_) w.store(nullptr, std::memory_order_relaxed);
+}
+
+ServerStats::~ServerStats() {
+	for (auto &w : workers_) delete w.load();
+}
+
+const char *ServerStats::RouteName(Route route) {
+	switch (route) {
+		case RouteGetUser:
+			return "GET /users/:id";
+		case RouteGetLocation:
+			return "GET /locations/:id";
+		case RouteGetVisit:
+			return "GET /visits/:id";
+		case RouteUserVisits:
+			return "GET /users/:id/visits";
+		case RouteLocationAvg:
+			return "GET /locations/:id/avg";
+		case RouteQuery:
+			return "GET /query";
+		case RoutePostUser:
+			return "POST /users/:id";
+		case RoutePostLocation:
+			return "POST /locations/:id";
+		case RoutePostVisit:
+			return "POST /visits/:id";
+		case RouteStats:
+			return "GET /stats";
+		default:
+			return "unknown";
+	}
+}
+
+ServerStats::Worker &ServerStats::local() {
+	if (tlsWorker < 0) tlsWorker = nextWorker_++ % kMaxWorkers;
+	Worker *w = workers_[tlsWorker].load(std::memory_order_acquire);
+	if (!w) {
+		// Slot is shared only after kMaxWorkers threads, so race on allocation is rare
+		Worker *fresh = new Worker;
+		if (workers_[tlsWorker].compare_exchange_strong(w, fresh)) {
+			w = fresh;
+		} else {
+			delete fresh;
+		}
+	}
+	return *w;
+}
+
+void ServerStats::Record(Route route, int status, size_t bytesIn, size_t bytesOut, uint64_t latencyUs, uint64_t allocs) {
+	auto &rs = local().routes[route];
+	rs.latency.Record(latencyUs);
+	if (status == 400) rs.status400.fetch_add(1, std::memory_order_relaxed);
+	if (status == 404) rs.status404.fetch_add(1, std::memory_order_relaxed);
+	rs.bytesIn.fetch_add(bytesIn, std::memory_order_relaxed);
+	rs.bytesOut.fetch_add(bytesOut, std::memory_order_relaxed);
+	rs.allocs.fetch_add(allocs, std::memory_order_relaxed);
+}
+
+static void appendf(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string &out, const char *fmt, ...) {
+	char buf[512];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	out.append(buf, std::min(size_t(n), sizeof(buf) - 1));
+}
+
+static void appendHistogram(std::string &out, const LatencyHistogram &h) {
+	appendf(out, "{\"count\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+			(unsigned long long)h.Count(), h.Mean(), (unsigned long long)h.Percentile(50), (unsigned long long)h.Percentile(90),
+			(unsigned long long)h.Percentile(99), (unsigned long long)h.Percentile(99.9), (unsigned long long)h.Max());
+}
+
+void ServerStats::GetJSON(std::string &out) const {
+	auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started_).count();
+	appendf(out, "\"uptime_sec\":%d,\"routes\":{", int(uptime));
+
+	bool first = true;
+	for (int r = 0; r < RouteCount; r++) {
+		LatencyHistogram latency;
+		uint64_t status400 = 0, status404 = 0, bytesIn = 0, bytesOut = 0, allocs = 0;
+		for (auto &slot : workers_) {
+			Worker *w = slot.load(std::memory_order_acquire);
+			if (!w) continue;
+			auto &rs = w->routes[r];
+			latency.Merge(rs.latency);
+			status400 += rs.status400.load(std::memory_order_relaxed);
+			status404 += rs.status404.load(std::memory_order_relaxed);
+			bytesIn += rs.bytesIn.load(std::memory_order_relaxed);
+			bytesOut += rs.bytesOut.load(std::memory_order_relaxed);
+			allocs += rs.allocs.load(std::memory_order_relaxed);
+		}
+		if (!latency.Count()) continue;
+		appendf(out,
+				"%s\"%s\":{\"status_400\":%llu,\"status_404\":%llu,\"bytes_in\":%llu,\"bytes_out\":%llu,\"allocs_per_request\":%.2f,"
+				"\"latency_us\":",
+				first ? "" : ",", RouteName(Route(r)), (unsigned long long)status400, (unsigned long long)status404,
+				(unsigned long long)bytesIn, (unsigned long long)bytesOut, double(allocs) / latency.Count());
+		appendHistogram(out, latency);
+		out += '}';
+		first = false;
+	}
+
+	out += '}';
+
+	out += ",\"query_select_us\":";
+	appendHistogram(out, timers_[TimerSelect]);
+	out += ",\"query_serialize_us\":";
+	appendHistogram(out, timers_[TimerSerialize]);
+	out += ",\"query_parse_us\":";
+	appendHistogram(out, timers_[TimerParse]);
+	out += ",\"mirror_apply_us\":";
+	appendHistogram(out, timers_[TimerMirrorApply]);
+}
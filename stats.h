@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include "histogram.h"
+
+enum Route {
+	RouteGetUser,
+	RouteGetLocation,
+	RouteGetVisit,
+	RouteUserVisits,
+	RouteLocationAvg,
+	RouteQuery,
+	RoutePostUser,
+	RoutePostLocation,
+	RoutePostVisit,
+	RouteStats,
+	RouteCount
+};
+
+// Durations of internal stages, which are not tied to route
+enum Timer { TimerSelect, TimerSerialize, TimerParse, TimerMirrorApply, TimerCount };
+
+// Always on request statistics. Each loop thread records to own slot with relaxed atomics,
+// so recording never contends with other threads. Slots are merged on read.
+class ServerStats {
+public:
+	ServerStats();
+	~ServerStats();
+	ServerStats(const ServerStats &) = delete;
+	ServerStats &operator=(const ServerStats &) = delete;
+
+	void Record(Route route, int status, size_t bytesIn, size_t bytesOut, uint64_t latencyUs, uint64_t allocs);
+	void Time(Timer timer, uint64_t us) { timers_[timer].Record(us); }
+	double MeanTime(Timer timer) const { return timers_[timer].Mean(); }
+	// Appends fields of json object with stats merged across threads
+	void GetJSON(std::string &out) const;
+
+	static const char *RouteName(Route route);
+
+protected:
+	struct RouteCounters {
+		LatencyHistogram latency;
+		std::atomic<uint64_t> status400, status404, bytesIn, bytesOut, allocs;
+		RouteCounters() : status400(0), status404(0), bytesIn(0), bytesOut(0), allocs(0) {}
+	};
+	struct Worker {
+		RouteCounters routes[RouteCount];
+	};
+	// More threads than slots are sharing slots, which is still correct, just contended
+	static const int kMaxWorkers = 32;
+
+	Worker &local();
+
+	std::atomic<Worker *> workers_[kMaxWorkers];
+	std::atomic<int> nextWorker_;
+	LatencyHistogram timers_[TimerCount];
+	std::chrono::steady_clock::time_point started_;
+};
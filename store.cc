@@ -0,0 +1,330 @@
+
+#include "store.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "kernels.h"
+
+using std::vector;
+
+void *AllocAligned(size_t size) {
+	void *p = nullptr;
+	if (posix_memalign(&p, kCacheLine, std::max(size, kCacheLine))) abort();
+	return p;
+}
+
+static_assert(sizeof(PackedVisit) == 16, "Visit must be packed to 16 bytes");
+// malloc returns 16 bytes aligned memory, so with 16 bytes header records of timeline never cross cache lines
+static_assert(sizeof(Timeline) == 16, "Records of timeline must be aligned");
+static_assert(DenseTable<PackedVisit>::kMaxId <= int(PackedVisit::kIdMask), "Ids must fit in packed visit");
+
+bool PackedVisit::Pack(const Visit &v, PackedVisit &out) {
+	if (v.user < 0 || uint64_t(v.user) > kIdMask || v.location < 0 || uint64_t(v.location) > kIdMask || v.mark < 0 ||
+		uint64_t(v.mark) > kMarkMask) {
+		return false;
+	}
+	out.id = v.id;
+	out.visited_at = v.visited_at;
+	out.bits = uint64_t(v.user) | (uint64_t(v.location) << kIdBits) | (uint64_t(v.mark) << (2 * kIdBits));
+	return true;
+}
+
+static bool operator<(const PackedVisit &l, const PackedVisit &r) {
+	return l.visited_at < r.visited_at || (l.visited_at == r.visited_at && l.id < r.id);
+}
+
+Timeline *Timeline::Alloc(int size) {
+	auto t = reinterpret_cast<Timeline *>(malloc(sizeof(Timeline) + size * sizeof(PackedVisit)));
+	t->size = size;
+	return t;
+}
+
+void Timeline::Free(Timeline *t) { free(t); }
+
+const PackedVisit *Timeline::LowerBound(int fromDate) const {
+	return std::upper_bound(begin(), end(), fromDate, [](int date, const PackedVisit &v) { return date < v.visited_at; });
+}
+
+const PackedVisit *Timeline::UpperBound(int toDate) const {
+	return std::lower_bound(begin(), end(), toDate, [](const PackedVisit &v, int date) { return v.visited_at < date; });
+}
+
+static bool operator<(const LocationVisit &l, const LocationVisit &r) {
+	return l.visited_at < r.visited_at || (l.visited_at == r.visited_at && l.visit < r.visit);
+}
+
+size_t LocationVisits::Bytes(int size) {
+	return sizeof(LocationVisits) + size * (3 * sizeof(int) + sizeof(int8_t) + sizeof(char)) + (size + 1) * sizeof(int);
+}
+
+LocationVisits *LocationVisits::Alloc(int size) {
+	auto l = reinterpret_cast<LocationVisits *>(malloc(Bytes(size)));
+	l->size = size;
+	l->reserved = 0;
+	return l;
+}
+
+void LocationVisits::Free(LocationVisits *l) { free(l); }
+
+void LocationVisits::Set(int i, const LocationVisit &v) {
+	const_cast<int *>(VisitedAt())[i] = v.visited_at;
+	const_cast<int *>(BirthDate())[i] = v.birth_date;
+	const_cast<int *>(VisitId())[i] = v.visit;
+	const_cast<int8_t *>(Mark())[i] = v.mark;
+	const_cast<char *>(Gender())[i] = v.gender;
+}
+
+void LocationVisits::BuildSums() {
+	int *sums = const_cast<int *>(MarkSum());
+	const int8_t *mark = Mark();
+	sums[0] = 0;
+	for (int i = 0; i < size; i++) sums[i + 1] = sums[i] + mark[i];
+}
+
+void LocationVisits::Aggregate(const AvgFilter &f, int64_t &sum, int &count) const {
+	const int *visitedAt = VisitedAt();
+	int lo = std::upper_bound(visitedAt, visitedAt + size, f.fromDate) - visitedAt;
+	int hi = std::lower_bound(visitedAt, visitedAt + size, f.toDate) - visitedAt;
+	if (lo >= hi) {
+		sum = count = 0;
+		return;
+	}
+
+	if (!f.gender && f.fromBirthDate == INT_MIN && f.toBirthDate == INT_MAX) {
+		sum = MarkSum()[hi] - MarkSum()[lo];
+		count = hi - lo;
+		return;
+	}
+
+	// Scan date range by blocks, so mask stays in L1
+	static const int kBlockSize = 1024;
+	uint64_t mask[kBlockSize / 64];
+	bool byBirthDate = f.fromBirthDate != INT_MIN || f.toBirthDate != INT_MAX;
+	sum = count = 0;
+	for (int beg = lo; beg < hi; beg += kBlockSize) {
+		int n = std::min(kBlockSize, hi - beg);
+		kernels::InitMask(mask, n);
+		if (byBirthDate) kernels::AndRange(BirthDate() + beg, n, f.fromBirthDate, f.toBirthDate, mask);
+		if (f.gender) kernels::AndEq(Gender() + beg, n, f.gender, mask);
+		kernels::MaskedSum(Mark() + beg, n, mask, sum, count);
+	}
+}
+
+// Unchanged strings are kept as is, so repeated updates of the same record are not growing arena
+const char *Store::putString(const char *s, const char *old) {
+	if (!s) s = "";
+	if (old && !strcmp(s, old)) return old;
+	return strings_.Put(s, strlen(s));
+}
+
+bool Store::PutUser(const User &user) {
+	auto old = users_.Get(user.id);
+	StoredUser u{user.id, user.birth_date, putString(user.email, old ? old->email : nullptr), dict_.Put(user.first_name),
+				 dict_.Put(user.last_name), dict_.Put(user.gender)};
+	if (u.first_name == StringDict::kNotFound || u.last_name == StringDict::kNotFound || u.gender == StringDict::kNotFound) return false;
+	// Visits may be posted before their user, and then location indexes have them without visitor's attributes
+	bool indexed = !old || old->birth_date != u.birth_date || old->gender != u.gender;
+	if (!users_.Put(u, epochs_)) return false;
+
+	// Visitor's attributes are copied to location indexes, so patch all locations visited by user
+	if (indexed) {
+		std::lock_guard<std::mutex> lock(indexMtx_);
+		auto timeline = timelines_.Get(u.id);
+		if (timeline) {
+			for (auto &uv : *timeline) {
+				LocationVisit lv{uv.visited_at, u.birth_date, uv.id, int8_t(uv.Mark()), dict_.Str(u.gender)[0]};
+				updateLocationVisits(uv.LocationId(), uv.id, &lv);
+			}
+		}
+	}
+	return true;
+}
+
+bool Store::PutLocation(const Location &location) {
+	StoredLocation l{location.id, location.distance, dict_.Put(location.place), dict_.Put(location.city), dict_.Put(location.country)};
+	if (l.place == StringDict::kNotFound || l.city == StringDict::kNotFound || l.country == StringDict::kNotFound) return false;
+	return locations_.Put(l, epochs_);
+}
+
+LocationVisit Store::locationVisit(const PackedVisit &visit) const {
+	auto user = users_.Get(visit.UserId());
+	char gender = user ? dict_.Str(user->gender)[0] : '\0';
+	return LocationVisit{visit.visited_at, user ? user->birth_date : 0, visit.id, int8_t(visit.Mark()), gender};
+}
+
+bool Store::PutVisit(const Visit &visit) {
+	PackedVisit pv;
+	if (!PackedVisit::Pack(visit, pv)) return false;
+
+	std::lock_guard<std::mutex> lock(indexMtx_);
+	auto old = visits_.Get(visit.id);
+	int oldUser = old ? old->UserId() : -1, oldLocation = old ? old->LocationId() : -1;
+	if (!visits_.Put(pv, epochs_)) return false;
+
+	if (oldUser >= 0 && oldUser != visit.user) {
+		updateTimeline(oldUser, visit.id, nullptr);
+	}
+	updateTimeline(visit.user, old ? visit.id : -1, &pv);
+
+	LocationVisit lv = locationVisit(pv);
+	if (oldLocation >= 0 && oldLocation != visit.location) {
+		updateLocationVisits(oldLocation, visit.id, nullptr);
+	}
+	updateLocationVisits(visit.location, old ? visit.id : -1, &lv);
+	return true;
+}
+
+// Makes a copy of user's timeline without removeVisit and with add, and publishes it
+void Store::updateTimeline(int user, int removeVisit, const PackedVisit *add) {
+	auto slot = timelines_.Slot(user);
+	if (!slot) return;
+	Timeline *old = slot->load(std::memory_order_acquire);
+	int oldSize = old ? old->size : 0;
+
+	Timeline *t = Timeline::Alloc(oldSize + (add ? 1 : 0));
+	PackedVisit *out = t->begin();
+	bool added = !add;
+	for (int i = 0; i < oldSize; i++) {
+		const PackedVisit &v = old->begin()[i];
+		if (v.id == removeVisit) continue;
+		if (!added && *add < v) {
+			*out++ = *add;
+			added = true;
+		}
+		*out++ = v;
+	}
+	if (!added) *out++ = *add;
+	t->size = out - t->begin();
+
+	slot->store(t, std::memory_order_release);
+	if (old) epochs_.Retire(old);
+}
+
+// Same as updateTimeline, but for location index
+void Store::updateLocationVisits(int location, int removeVisit, const LocationVisit *add) {
+	auto slot = locationVisits_.Slot(location);
+	if (!slot) return;
+	LocationVisits *old = slot->load(std::memory_order_acquire);
+	int oldSize = old ? old->size : 0;
+
+	// Columns offsets are depending on size, so it must be known before copy
+	bool removed = old && std::find(old->VisitId(), old->VisitId() + oldSize, removeVisit) != old->VisitId() + oldSize;
+	LocationVisits *l = LocationVisits::Alloc(oldSize - (removed ? 1 : 0) + (add ? 1 : 0));
+	int n = 0;
+	bool added = !add;
+	for (int i = 0; i < oldSize; i++) {
+		LocationVisit v = old->At(i);
+		if (v.visit == removeVisit) continue;
+		if (!added && *add < v) {
+			l->Set(n++, *add);
+			added = true;
+		}
+		l->Set(n++, v);
+	}
+	if (!added) l->Set(n++, *add);
+	l->BuildSums();
+
+	slot->store(l, std::memory_order_release);
+	if (old) epochs_.Retire(old);
+}
+
+Store::~Store() {
+	timelines_.ForEach([](int, Timeline *t) { Timeline::Free(t); });
+	locationVisits_.ForEach([](int, LocationVisits *l) { LocationVisits::Free(l); });
+}
+
+bool Store::Load(const vector<User> &users, const vector<Location> &locations, const vector<Visit> &visits) {
+	// Ids are dense, so loaded ones give sizes of tables, which are mapped at once and may be backed by huge pages
+	if (hugePages_ != HugePagesOff) {
+		int maxUser = 0, maxLocation = 0, maxVisit = 0;
+		for (auto &u : users) maxUser = std::max(maxUser, u.id);
+		for (auto &l : locations) maxLocation = std::max(maxLocation, l.id);
+		for (auto &v : visits) maxVisit = std::max(maxVisit, v.id);
+		users_.Reserve(maxUser, hugePages_);
+		locations_.Reserve(maxLocation, hugePages_);
+		tablesBacking_ = visits_.Reserve(maxVisit, hugePages_);
+	}
+
+	for (auto &u : users) {
+		if (!PutUser(u)) return false;
+	}
+	for (auto &l : locations) {
+		if (!PutLocation(l)) return false;
+	}
+
+	// Build indexes at once: inserting visits one by one would copy index on each visit
+	int maxUser = 0, maxLocation = 0;
+	for (auto &v : visits) {
+		PackedVisit pv;
+		if (!PackedVisit::Pack(v, pv) || !visits_.Put(pv, epochs_)) return false;
+		maxUser = std::max(maxUser, v.user);
+		maxLocation = std::max(maxLocation, v.location);
+	}
+	return buildTimelines(visits, maxUser) && buildLocationVisits(visits, maxLocation);
+}
+
+bool Store::buildTimelines(const vector<Visit> &visits, int maxUser) {
+	vector<int> counts(maxUser + 1, 0);
+	for (auto &v : visits) counts[v.user]++;
+
+	vector<Timeline *> timelines(maxUser + 1, nullptr);
+	for (int user = 0; user <= maxUser; user++) {
+		if (!counts[user]) continue;
+		timelines[user] = Timeline::Alloc(counts[user]);
+		timelines[user]->size = 0;
+	}
+	for (auto &v : visits) {
+		Timeline *t = timelines[v.user];
+		PackedVisit::Pack(v, t->begin()[t->size++]);
+	}
+	for (int user = 0; user <= maxUser; user++) {
+		Timeline *t = timelines[user];
+		if (!t) continue;
+		std::sort(t->begin(), t->begin() + t->size);
+		auto slot = timelines_.Slot(user);
+		if (!slot) return false;
+		slot->store(t, std::memory_order_release);
+	}
+	return true;
+}
+
+bool Store::buildLocationVisits(const vector<Visit> &visits, int maxLocation) {
+	// Group visits by location (counting sort), then sort each group by visited_at
+	vector<int> offsets(maxLocation + 2, 0);
+	for (auto &v : visits) offsets[v.location + 1]++;
+	for (int i = 0; i <= maxLocation; i++) offsets[i + 1] += offsets[i];
+
+	vector<LocationVisit> grouped(visits.size());
+	vector<int> pos(offsets.begin(), offsets.end() - 1);
+	for (auto &v : visits) {
+		PackedVisit pv;
+		PackedVisit::Pack(v, pv);
+		grouped[pos[v.location]++] = locationVisit(pv);
+	}
+
+	for (int location = 0; location <= maxLocation; location++) {
+		int beg = offsets[location], end = offsets[location + 1];
+		if (beg == end) continue;
+		std::sort(grouped.begin() + beg, grouped.begin() + end);
+
+		LocationVisits *l = LocationVisits::Alloc(end - beg);
+		for (int i = beg; i < end; i++) l->Set(i - beg, grouped[i]);
+		l->BuildSums();
+		auto slot = locationVisits_.Slot(location);
+		if (!slot) {
+			LocationVisits::Free(l);
+			return false;
+		}
+		slot->store(l, std::memory_order_release);
+	}
+	return true;
+}
+
+size_t Store::MemUsage() const {
+	size_t sz = users_.MemUsage() + locations_.MemUsage() + visits_.MemUsage() + timelines_.MemUsage() + locationVisits_.MemUsage() +
+				strings_.Size() + dict_.MemUsage();
+	timelines_.ForEach([&sz](int, const Timeline *t) { sz += sizeof(Timeline) + t->size * sizeof(PackedVisit); });
+	locationVisits_.ForEach([&sz](int, const LocationVisits *l) { sz += LocationVisits::Bytes(l->size); });
+	return sz;
+}
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+#include "dictionary.h"
+#include "entities.h"
+#include "epoch.h"
+#include "hugepages.h"
+#include "string_arena.h"
+
+static const size_t kCacheLine = 64;
+
+// Cache line aligned malloc for large blocks, memory is freed by free()
+void *AllocAligned(size_t size);
+
+// Paged table of atomic pointers indexed by id. Unlike DenseTable, slots may be
+// requested concurrently (e.g. by readers filling caches), so pages are published by CAS.
+template <typename T>
+class PtrTable {
+public:
+	static const int kPageBits = 12;
+	static const int kPageSize = 1 << kPageBits;
+	static const int kMaxPages = 1 << 13;
+	static const int kMaxId = kPageSize * kMaxPages - 1;
+
+	PtrTable() {
+		for (auto &p : pages_) p.store(nullptr, std::memory_order_relaxed);
+	}
+	~PtrTable() {
+		for (auto &p : pages_) delete[] p.load(std::memory_order_relaxed);
+	}
+	PtrTable(const PtrTable &) = delete;
+	PtrTable &operator=(const PtrTable &) = delete;
+
+	T *Get(int id) const {
+		if (id < 0 || id > kMaxId) return nullptr;
+		auto page = pages_[id >> kPageBits].load(std::memory_order_acquire);
+		if (!page) return nullptr;
+		return page[id & (kPageSize - 1)].load(std::memory_order_acquire);
+	}
+
+	std::atomic<T *> *Slot(int id) {
+		if (id < 0 || id > kMaxId) return nullptr;
+		auto &page = pages_[id >> kPageBits];
+		auto p = page.load(std::memory_order_acquire);
+		if (!p) {
+			// Each of racing threads allocates page, and losers free their own
+			auto fresh = new std::atomic<T *>[kPageSize];
+			for (int i = 0; i < kPageSize; i++) fresh[i].store(nullptr, std::memory_order_relaxed);
+			if (page.compare_exchange_strong(p, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+				p = fresh;
+			} else {
+				delete[] fresh;
+			}
+		}
+		return &p[id & (kPageSize - 1)];
+	}
+
+	// Calls f(id, ptr) for each non null pointer
+	template <typename F>
+	void ForEach(F f) const {
+		for (int n = 0; n < kMaxPages; n++) {
+			auto page = pages_[n].load(std::memory_order_acquire);
+			if (!page) continue;
+			for (int i = 0; i < kPageSize; i++) {
+				T *p = page[i].load(std::memory_order_acquire);
+				if (p) f((n << kPageBits) + i, p);
+			}
+		}
+	}
+
+	size_t MemUsage() const {
+		size_t sz = sizeof(*this);
+		for (auto &p : pages_) sz += p.load(std::memory_order_relaxed) ? kPageSize * sizeof(std::atomic<T *>) : 0;
+		return sz;
+	}
+
+protected:
+	std::atomic<std::atomic<T *> *> pages_[kMaxPages];
+};
+
+// Direct address table of records indexed by id. Ids are small dense integers, so records are
+// kept in fixed size cache line aligned pages, and page directory is preallocated: existing records
+// never move, and lookup is just two memory loads without locks.
+// Slot is written once, before its id is published, and then is immutable. Update stores a copy of
+// record to table of copies, which overrides slot, and copy of the next update replaces it, while
+// the previous copy is retired to epoch manager. So readers must hold epoch guard while they use record.
+// Empty slots have id == -1. Writers must be serialized by caller.
+template <typename T>
+class DenseTable {
+	static_assert(std::is_pod<T>::value, "Pages are raw memory");
+	static_assert(offsetof(T, id) == 0, "Id publishes record, so it's written separately from other fields");
+
+public:
+	static const int kPageBits = 12;
+	static const int kPageSize = 1 << kPageBits;
+	static const int kMaxPages = 1 << 13;
+	static const int kMaxId = kPageSize * kMaxPages - 1;
+
+	DenseTable() : count_(0), copied_(0), region_(nullptr), regionPages_(0) {
+		for (auto &p : pages_) p.store(nullptr, std::memory_order_relaxed);
+	}
+	~DenseTable() {
+		for (int n = regionPages_; n < kMaxPages; n++) free(pages_[n].load(std::memory_order_relaxed));
+		UnmapRegion(region_, regionPages_ * kPageSize * sizeof(T));
+		copies_.ForEach([](int, T *rec) { free(rec); });
+	}
+	DenseTable(const DenseTable &) = delete;
+	DenseTable &operator=(const DenseTable &) = delete;
+
+	const T *Get(int id) const {
+		if (id < 0 || id > kMaxId) return nullptr;
+		// Directory of copies is mostly empty, so lookup of record, which was never updated, is one load more
+		if (const T *copy = copies_.Get(id)) return copy;
+		const T *page = pages_[id >> kPageBits].load(std::memory_order_acquire);
+		if (!page) return nullptr;
+		const T *rec = &page[id & (kPageSize - 1)];
+		return __atomic_load_n(&rec->id, __ATOMIC_ACQUIRE) == id ? rec : nullptr;
+	}
+
+	// Stores record. Record becomes visible to readers only after all its fields are written,
+	// and replaced record is retired to epochs
+	bool Put(const T &rec, EpochManager &epochs) {
+		T *slot = this->slot(rec.id);
+		if (!slot) return false;
+		if (__atomic_load_n(&slot->id, __ATOMIC_RELAXED) == -1) {
+			// Readers are checking id of slot, so it's not written with other fields
+			const char *fields = reinterpret_cast<const char *>(&rec) + sizeof(int);
+			memcpy(reinterpret_cast<char *>(slot) + sizeof(int), fields, sizeof(T) - sizeof(int));
+			__atomic_store_n(&slot->id, rec.id, __ATOMIC_RELEASE);
+			count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		T *copy = static_cast<T *>(malloc(sizeof(T)));
+		*copy = rec;
+		T *old = copies_.Slot(rec.id)->exchange(copy, std::memory_order_acq_rel);
+		// Record in page is not freed, it just becomes unreachable for new readers
+		if (old) {
+			epochs.Retire(old);
+		} else {
+			copied_.store(copied_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		return true;
+	}
+
+	// Maps pages for ids up to maxId as one region, so they can be backed by huge pages. Pages of greater ids are
+	// allocated one by one as usual. Must be called on empty table. Returns backing which is actually used
+	HugePages Reserve(int maxId, HugePages mode) {
+		if (region_ || Count() || maxId < 0 || maxId > kMaxId) return HugePagesOff;
+		int pages = (maxId >> kPageBits) + 1;
+		HugePages used = HugePagesOff;
+		region_ = static_cast<T *>(MapRegion(pages * kPageSize * sizeof(T), mode, used));
+		if (region_) regionPages_ = pages;
+		return used;
+	}
+
+	size_t Count() const { return count_.load(std::memory_order_relaxed); }
+	size_t MemUsage() const {
+		size_t sz = sizeof(*this) + copies_.MemUsage() + copied_.load(std::memory_order_relaxed) * sizeof(T);
+		for (auto &p : pages_) sz += p.load(std::memory_order_relaxed) ? kPageSize * sizeof(T) : 0;
+		return sz;
+	}
+
+protected:
+	// Returns slot for id, allocating page if needed. Returns nullptr if id is out of range
+	T *slot(int id) {
+		if (id < 0 || id > kMaxId) return nullptr;
+		T *page = pages_[id >> kPageBits].load(std::memory_order_acquire);
+		if (!page) {
+			int n = id >> kPageBits;
+			page = n < regionPages_ ? region_ + n * kPageSize : static_cast<T *>(AllocAligned(kPageSize * sizeof(T)));
+			for (int i = 0; i < kPageSize; i++) page[i].id = -1;
+			pages_[id >> kPageBits].store(page, std::memory_order_release);
+		}
+		return &page[id & (kPageSize - 1)];
+	}
+
+	std::atomic<T *> pages_[kMaxPages];
+	// Counters are written by writer only, and are read by stats
+	std::atomic<size_t> count_, copied_;
+	// Pages below regionPages_ are carved from region_ instead of malloc
+	T *region_;
+	int regionPages_;
+	// Latest versions of updated records
+	PtrTable<T> copies_;
+};
+
+// Visit packed to 16 bytes, 4 records per cache line. Ids of user and location fit in 25 bits,
+// as any id in store, and mark in 3 bits. Record is used both in visits table and in user timelines.
+struct PackedVisit {
+	static const int kIdBits = 25;
+	static const int kMarkBits = 3;
+	static const uint64_t kIdMask = (uint64_t(1) << kIdBits) - 1;
+	static const uint64_t kMarkMask = (uint64_t(1) << kMarkBits) - 1;
+
+	int id;
+	int visited_at;
+	uint64_t bits;
+
+	int UserId() const { return int(bits & kIdMask); }
+	int LocationId() const { return int((bits >> kIdBits) & kIdMask); }
+	int Mark() const { return int((bits >> (2 * kIdBits)) & kMarkMask); }
+
+	// Returns false, if fields are out of packed ranges
+	static bool Pack(const Visit &v, PackedVisit &out);
+	Visit Unpack() const { return Visit{id, UserId(), LocationId(), visited_at, Mark()}; }
+};
+
+// Visits of user, ordered by visited_at. Timeline is immutable: update makes a new copy,
+// and the old one is retired to epoch manager, so pinned readers need no locks.
+// Header is 16 bytes, so records are 16 bytes aligned and never cross cache lines.
+struct Timeline {
+	int size;
+	int reserved[3];
+
+	const PackedVisit *begin() const { return reinterpret_cast<const PackedVisit *>(this + 1); }
+	const PackedVisit *end() const { return begin() + size; }
+	PackedVisit *begin() { return reinterpret_cast<PackedVisit *>(this + 1); }
+	PackedVisit *end() { return begin() + size; }
+
+	// Bounds of visits with fromDate < visited_at < toDate
+	const PackedVisit *LowerBound(int fromDate) const;
+	const PackedVisit *UpperBound(int toDate) const;
+
+	static Timeline *Alloc(int size);
+	static void Free(Timeline *t);
+};
+
+// Visit in location's index
+struct LocationVisit {
+	int visited_at;
+	int birth_date;
+	int visit;
+	int8_t mark;
+	char gender;
+};
+
+// Filter of /locations/<id>/avg. Bounds are exclusive, gender 0 means any
+struct AvgFilter {
+	int fromDate, toDate;
+	int fromBirthDate, toBirthDate;
+	char gender;
+};
+
+// Visits of location, ordered by visited_at, with gender and birth_date of visitor.
+// Columns are stored separately for tight vectorizable scans, and prefix sums of marks
+// answer queries with date filters only in O(log n). Like Timeline, it is immutable.
+struct LocationVisits {
+	int size;
+	int reserved;
+
+	const int *VisitedAt() const { return reinterpret_cast<const int *>(this + 1); }
+	const int *BirthDate() const { return VisitedAt() + size; }
+	const int *VisitId() const { return BirthDate() + size; }
+	// size + 1 elements, MarkSum()[i] is sum of marks of visits before i
+	const int *MarkSum() const { return VisitId() + size; }
+	const int8_t *Mark() const { return reinterpret_cast<const int8_t *>(MarkSum() + size + 1); }
+	const char *Gender() const { return reinterpret_cast<const char *>(Mark() + size); }
+
+	LocationVisit At(int i) const { return LocationVisit{VisitedAt()[i], BirthDate()[i], VisitId()[i], Mark()[i], Gender()[i]}; }
+	void Set(int i, const LocationVisit &v);
+	void BuildSums();
+
+	// Sum and count of marks matching filter
+	void Aggregate(const AvgFilter &f, int64_t &sum, int &count) const;
+
+	static size_t Bytes(int size);
+	static LocationVisits *Alloc(int size);
+	static void Free(LocationVisits *l);
+};
+
+// Stored records. Low cardinality strings are codes in store's dictionary, only email is unique per user
+struct StoredUser {
+	int id;
+	int birth_date;
+	const char *email;
+	uint32_t first_name;
+	uint32_t last_name;
+	uint32_t gender;
+};
+
+struct StoredLocation {
+	int id;
+	int distance;
+	uint32_t place;
+	uint32_t city;
+	uint32_t country;
+};
+
+// In memory copy of all entities for O(1) lookups by id on hot GET paths,
+// per user timelines and per location indexes of visits.
+// Strings of records are owned by store. Writers of each entity must be serialized by caller.
+// Records, timelines and location indexes are replaced by copies on update, so readers and writers
+// must hold guard of Epochs() while they use them.
+class Store {
+public:
+	Store() : hugePages_(HugePagesOff), tablesBacking_(HugePagesOff) {}
+	~Store();
+
+	const StoredUser *GetUser(int id) const { return users_.Get(id); }
+	const StoredLocation *GetLocation(int id) const { return locations_.Get(id); }
+	const PackedVisit *GetVisit(int id) const { return visits_.Get(id); }
+	const Timeline *GetUserVisits(int user) const { return timelines_.Get(user); }
+	const LocationVisits *GetLocationVisits(int location) const { return locationVisits_.Get(location); }
+	size_t UsersCount() const { return users_.Count(); }
+	size_t LocationsCount() const { return locations_.Count(); }
+	size_t VisitsCount() const { return visits_.Count(); }
+	const StringDict &Dict() const { return dict_; }
+	EpochManager &Epochs() const { return epochs_; }
+
+	// Plain records with strings of stored ones. Strings are owned by store and valid forever
+	User Decode(const StoredUser &u) const {
+		return User{u.id, u.birth_date, dict_.Str(u.gender), dict_.Str(u.first_name), dict_.Str(u.last_name), u.email};
+	}
+	Location Decode(const StoredLocation &l) const {
+		return Location{l.id, l.distance, dict_.Str(l.place), dict_.Str(l.city), dict_.Str(l.country)};
+	}
+
+	// Huge pages backing of tables of records, which are sized on load. Must be set before load
+	void SetHugePages(HugePages mode) { hugePages_ = mode; }
+	// Backing of visits table, the largest one, which is actually used after load
+	HugePages TablesBacking() const { return tablesBacking_; }
+
+	// Bulk load of all entities into empty store
+	bool Load(const std::vector<User> &users, const std::vector<Location> &locations, const std::vector<Visit> &visits);
+
+	bool PutUser(const User &user);
+	bool PutLocation(const Location &location);
+	bool PutVisit(const Visit &visit);
+
+	// Frees memory retired by writers, which can not be used by readers anymore
+	void CollectGarbage() { epochs_.Collect(); }
+
+	size_t MemUsage() const;
+
+protected:
+	const char *putString(const char *s, const char *old);
+	void updateTimeline(int user, int removeVisit, const PackedVisit *add);
+	void updateLocationVisits(int location, int removeVisit, const LocationVisit *add);
+	LocationVisit locationVisit(const PackedVisit &visit) const;
+	bool buildTimelines(const std::vector<Visit> &visits, int maxUser);
+	bool buildLocationVisits(const std::vector<Visit> &visits, int maxLocation);
+
+	DenseTable<StoredUser> users_;
+	DenseTable<StoredLocation> locations_;
+	DenseTable<PackedVisit> visits_;
+	PtrTable<Timeline> timelines_;
+	PtrTable<LocationVisits> locationVisits_;
+	StringArena strings_;
+	StringDict dict_;
+	HugePages hugePages_, tablesBacking_;
+	// Serializes updates of timelines and location indexes: they are updated by writers of visits and users
+	std::mutex indexMtx_;
+	// Updated records, timelines and location indexes are allocated by malloc, so retired memory is just freed
+	mutable EpochManager epochs_;
+};
@@ -0,0 +1,27 @@
+#include "string_arena.h"
+#include <string.h>
+#include <algorithm>
+
+const size_t StringArena::kBlockSize;
+
+char *StringArena::Alloc(size_t len) {
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (len > left_) {
+		size_t blockSize = std::max(kBlockSize, len);
+		blocks_.push_back(std::unique_ptr<char[]>(new char[blockSize]));
+		pos_ = blocks_.back().get();
+		left_ = blockSize;
+		size_ += blockSize;
+	}
+	char *ret = pos_;
+	pos_ += len;
+	left_ -= len;
+	return ret;
+}
+
+const char *StringArena::Put(const char *s, size_t len) {
+	char *ret = Alloc(len + 1);
+	memcpy(ret, s, len);
+	ret[len] = 0;
+	return ret;
+}
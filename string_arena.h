@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Append only storage for entity strings. Memory is never returned until destruction,
+// so readers may keep pointers to old strings while writers replace them.
+class StringArena {
+public:
+	StringArena() : pos_(nullptr), left_(0), size_(0) {}
+	StringArena(const StringArena &) = delete;
+	StringArena &operator=(const StringArena &) = delete;
+
+	const char *Put(const char *s, size_t len);
+	char *Alloc(size_t len);
+	size_t Size() const { return size_; }
+
+protected:
+	static const size_t kBlockSize = 1 << 20;
+
+	std::mutex mtx_;
+	std::vector<std::unique_ptr<char[]>> blocks_;
+	char *pos_;
+	size_t left_;
+	size_t size_;
+};
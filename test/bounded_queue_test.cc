@@ -0,0 +1,63 @@
+#include <thread>
+#include <vector>
+#include "bounded_queue.h"
+#include "test.h"
+
+TEST(BoundedQueueFullAndEmpty) {
+	BoundedQueue<int> q(4);
+	int val;
+	CHECK(!q.Pop(val));
+	for (int i = 0; i < 4; i++) CHECK(q.Push(i));
+	CHECK(!q.Push(4));
+	CHECK(q.Size() == 4);
+	// Cells are reused after wrap around, and order is kept
+	for (int round = 0; round < 3; round++) {
+		CHECK(q.Pop(val) && val == round);
+		CHECK(q.Push(4 + round));
+		CHECK(!q.Push(-1));
+	}
+	for (int i = 3; i < 7; i++) CHECK(q.Pop(val) && val == i);
+	CHECK(!q.Pop(val));
+	CHECK(q.Size() == 0);
+}
+
+TEST(BoundedQueueManyProducersAndConsumers) {
+	const int kProducers = 4, kConsumers = 4, kPerProducer = 100000;
+	BoundedQueue<int> q(64);
+	std::vector<std::vector<int>> popped(kConsumers);
+	std::atomic<int> left(kProducers * kPerProducer);
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < kProducers; p++) {
+		threads.emplace_back([&q, p]() {
+			for (int i = 0; i < kPerProducer; i++) {
+				while (!q.Push(p * kPerProducer + i)) std::this_thread::yield();
+			}
+		});
+	}
+	for (int c = 0; c < kConsumers; c++) {
+		threads.emplace_back([&q, &popped, &left, c]() {
+			int val;
+			while (left.load() > 0) {
+				if (!q.Pop(val)) continue;
+				popped[c].push_back(val);
+				left--;
+			}
+		});
+	}
+	for (auto &t : threads) t.join();
+
+	// Each value is popped exactly once, and values of one producer are popped by each consumer in order
+	std::vector<int> seen(kProducers * kPerProducer, 0);
+	for (auto &vals : popped) {
+		std::vector<int> last(kProducers, -1);
+		for (int v : vals) {
+			seen[v]++;
+			CHECK(v > last[v / kPerProducer]);
+			last[v / kPerProducer] = v;
+		}
+	}
+	int once = 0;
+	for (int n : seen) once += n == 1;
+	CHECK(once == kProducers * kPerProducer);
+}
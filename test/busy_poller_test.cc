@@ -0,0 +1,62 @@
+#include <unistd.h>
+#include <thread>
+#include "busy_poller.h"
+#include "test.h"
+
+TEST(BusyPollerLoopSpinsByOwnActivity) {
+	BusyPoller poller;
+	poller.Activity();
+	CHECK(poller.Spinning());
+	// Other loop has no requests, so it stays parked
+	bool otherSpinning = true;
+	std::thread([&poller, &otherSpinning]() { otherSpinning = poller.Spinning(); }).join();
+	CHECK(!otherSpinning);
+
+	// Loop parks after its window without requests
+	usleep(30000);
+	poller.Tick();
+	CHECK(!poller.Spinning());
+	auto st = poller.TakeStats();
+	CHECK(st.spins == 1 && st.parks == 1 && st.wakeups == 1);
+}
+
+TEST(BusyPollerSteadyLoadKeepsSpinning) {
+	BusyPoller poller;
+	for (int i = 0; i < 50; i++) {
+		poller.Activity();
+		usleep(500);
+		poller.Tick();
+		CHECK(poller.Spinning());
+	}
+	// Window follows gap between requests, which is far below the longest one
+	auto st = poller.TakeStats();
+	CHECK(st.parks == 0 && st.wakeups == 1);
+	CHECK(st.windowUs < 20000);
+	CHECK(st.spinTimeUs > 0);
+}
+
+TEST(BusyPollerPauseParksLoops) {
+	BusyPoller poller;
+	poller.Activity();
+	{
+		BusyPoller::Pause pause(poller);
+		CHECK(!poller.Spinning());
+		// Requests during background work don't wake up spinning
+		poller.Activity();
+		poller.Tick();
+		CHECK(!poller.Spinning());
+	}
+	poller.Activity();
+	CHECK(poller.Spinning());
+}
+
+TEST(BusyPollerWakeupLatencyOfLoops) {
+	BusyPoller poller;
+	poller.Wakeup(10);
+	poller.Wakeup(30);
+	std::thread([&poller]() { poller.Wakeup(80); }).join();
+	auto st = poller.TakeStats();
+	CHECK(st.wakeLatencyUs == 40 && st.wakeLatencyMaxUs == 80);
+	st = poller.TakeStats();
+	CHECK(st.wakeLatencyUs == 0 && st.wakeLatencyMaxUs == 0);
+}
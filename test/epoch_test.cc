@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "epoch.h"
+#include "test.h"
+
+static std::atomic<int> freed(0);
+static void countFree(void *p) {
+	freed++;
+	free(p);
+}
+
+// Holds epoch guard in own thread until released
+class PinnedReader {
+public:
+	explicit PinnedReader(EpochManager &em) : pinned_(false), release_(false) {
+		th_ = std::thread([this, &em]() {
+			EpochManager::Guard guard(em);
+			pinned_ = true;
+			while (!release_) std::this_thread::yield();
+		});
+		while (!pinned_) std::this_thread::yield();
+	}
+	~PinnedReader() { Release(); }
+	void Release() {
+		release_ = true;
+		if (th_.joinable()) th_.join();
+	}
+
+protected:
+	std::atomic<bool> pinned_, release_;
+	std::thread th_;
+};
+
+TEST(EpochRetiredIsFreedAfterReaderLeaves) {
+	EpochManager em;
+	freed = 0;
+	em.Retire(malloc(16), countFree);
+	// Nobody is pinned, so memory is freed by the first collect
+	em.Collect();
+	CHECK(freed == 1 && em.Pending() == 0);
+
+	PinnedReader reader(em);
+	em.Retire(malloc(16), countFree);
+	em.Collect();
+	em.Collect();
+	CHECK(freed == 1 && em.Pending() == 1);
+	reader.Release();
+	em.Collect();
+	CHECK(freed == 2 && em.Pending() == 0);
+}
+
+TEST(EpochPinnedReaderHoldsRetiresOfItsEpochAndLater) {
+	EpochManager em;
+	freed = 0;
+	// Retired in the epoch, which reader pins: reader may have loaded it before pin was visible
+	em.Retire(malloc(16), countFree);
+	PinnedReader reader(em);
+	em.Collect();
+	CHECK(freed == 0);
+	em.Collect();
+	em.Retire(malloc(16), countFree);
+	em.Collect();
+	CHECK(freed == 0 && em.Pending() == 2);
+	reader.Release();
+	em.Collect();
+	CHECK(freed == 2);
+}
+
+TEST(EpochOverflowOfRing) {
+	freed = 0;
+	{
+		EpochManager em;
+		// Collector is stalled, so retires overflow ring of thread
+		const int kRetires = 10000;
+		for (int i = 0; i < kRetires; i++) em.Retire(malloc(16), countFree);
+		CHECK(em.Pending() == size_t(kRetires));
+		em.Collect();
+		CHECK(freed == kRetires && em.Pending() == 0);
+
+		// Pending memory is freed by destructor
+		for (int i = 0; i < kRetires; i++) em.Retire(malloc(16), countFree);
+	}
+	CHECK(freed == 20000);
+}
+
+TEST(EpochReadersNeverSeeFreedMemory) {
+	static const int kAlive = 0x5a5a5a5a;
+	EpochManager em;
+	std::atomic<int *> shared(new int(kAlive));
+	std::atomic<bool> stop(false);
+	std::atomic<int> bad(0);
+	std::atomic<uint64_t> reads(0);
+
+	std::vector<std::thread> threads;
+	for (int r = 0; r < 4; r++) {
+		threads.emplace_back([&]() {
+			while (!stop) {
+				EpochManager::Guard guard(em);
+				int *p = shared.load(std::memory_order_acquire);
+				for (int i = 0; i < 16; i++) {
+					if (*p != kAlive) bad++;
+				}
+				reads++;
+			}
+		});
+	}
+	threads.emplace_back([&]() {
+		while (!stop) em.Collect();
+	});
+	// Old value is poisoned before free, so reader of freed memory sees poison even without sanitizer
+	const int kWrites = 200000;
+	for (int i = 0; i < kWrites; i++) {
+		int *old = shared.exchange(new int(kAlive), std::memory_order_acq_rel);
+		em.Retire(old, [](void *p) {
+			*static_cast<int *>(p) = 0;
+			delete static_cast<int *>(p);
+		});
+	}
+	stop = true;
+	for (auto &t : threads) t.join();
+	em.Collect();
+
+	CHECK(bad == 0);
+	CHECK(reads > 0);
+	CHECK(em.Pending() == 0);
+	delete shared.load();
+}
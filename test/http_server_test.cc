@@ -0,0 +1,429 @@
+#include <netinet/in.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "http_server.h"
+#include "test.h"
+
+// Handlers of test server
+class Handlers {
+public:
+	// Echoes path params and query
+	int Echo(http::Context &ctx) {
+		std::string out = ctx.request->pathParams;
+		for (auto &p : ctx.request->params) out += std::string("|") + p.name + "=" + p.val;
+		return ctx.JSON(http::StatusOK, out.data(), out.size());
+	}
+	int Body(http::Context &ctx) {
+		std::string body(ctx.body->Pending(), 0);
+		ctx.body->Read(&body[0], body.size());
+		return ctx.JSON(http::StatusOK, body.data(), body.size());
+	}
+	// Body of unknown length is sent by chunks
+	int Chunked(http::Context &ctx) {
+		ctx.writer->SetRespCode(http::StatusOK);
+		ctx.writer->Write("ab", 2);
+		ctx.writer->Write("cde", 3);
+		return 0;
+	}
+	// Writes chunks of 4KB until client stops reading, up to count from path, and ends with number of them
+	int Stream(http::Context &ctx) {
+		std::string chunk(4096, 's');
+		int n = 0, max = atoi(ctx.request->pathParams);
+		ctx.writer->SetRespCode(http::StatusOK);
+		while (n < max && !ctx.writer->Congested()) {
+			ctx.writer->Write(chunk.data(), chunk.size());
+			n++;
+		}
+		std::string tail = "|" + std::to_string(n);
+		ctx.writer->Write(tail.data(), tail.size());
+		return 0;
+	}
+	// Body of size from path
+	int Big(http::Context &ctx) {
+		std::string body(atoi(ctx.request->pathParams), 'x');
+		return ctx.JSON(http::StatusOK, body.data(), body.size());
+	}
+};
+
+struct TestServer {
+	explicit TestServer(int loops = 2, bool reusePort = false, std::function<void(int)> start = nullptr,
+						std::function<void(uint64_t)> wakeup = nullptr)
+		: listener(router) {
+		signal(SIGPIPE, SIG_IGN);
+		router.GET<Handlers, &Handlers::Echo>("/echo/", &handlers);
+		router.POST<Handlers, &Handlers::Body>("/body", &handlers);
+		router.GET<Handlers, &Handlers::Chunked>("/chunked", &handlers);
+		router.GET<Handlers, &Handlers::Big>("/big/", &handlers);
+		router.GET<Handlers, &Handlers::Stream>("/stream/", &handlers);
+		listener.SetReusePort(reusePort);
+		listener.SetThreadStart(start);
+		listener.SetWakeupLatency(wakeup);
+		ok = listener.Bind(0);
+		if (!ok) return;
+		listener.Fork(loops - 1);
+		thread = std::thread([this]() { listener.Run(); });
+	}
+	~TestServer() {
+		listener.Stop();
+		if (thread.joinable()) thread.join();
+	}
+
+	int Connect() {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(listener.Port());
+		if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	Handlers handlers;
+	http::Router router;
+	http::Listener listener;
+	std::thread thread;
+	bool ok;
+};
+
+static bool sendAll(int fd, const std::string &data) {
+	for (size_t sent = 0; sent < data.size();) {
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+
+struct Response {
+	int code;
+	bool close;
+	std::string body;
+};
+
+// Blocking client side of connection, which parses responses with content length or chunked
+class Client {
+public:
+	explicit Client(int fd) : fd_(fd) {}
+	~Client() {
+		if (fd_ >= 0) close(fd_);
+	}
+
+	bool Read(Response &resp) {
+		size_t hdrEnd;
+		while ((hdrEnd = buf_.find("\r\n\r\n")) == std::string::npos) {
+			if (!fill()) return false;
+		}
+		std::string hdrs = buf_.substr(0, hdrEnd + 2);
+		buf_.erase(0, hdrEnd + 4);
+		resp.code = atoi(hdrs.c_str() + 9);
+		resp.close = hdrs.find("Connection: close") != std::string::npos;
+		resp.body.clear();
+		size_t pos = hdrs.find("Content-Length: ");
+		if (pos != std::string::npos) return readBody(atoi(hdrs.c_str() + pos + 16), resp.body);
+		if (hdrs.find("Transfer-Encoding: chunked") == std::string::npos) return false;
+		for (;;) {
+			size_t eol;
+			while ((eol = buf_.find("\r\n")) == std::string::npos) {
+				if (!fill()) return false;
+			}
+			size_t len = strtoul(buf_.c_str(), nullptr, 16);
+			buf_.erase(0, eol + 2);
+			std::string chunk;
+			if (!readBody(len + 2, chunk)) return false;
+			if (!len) return true;
+			resp.body += chunk.substr(0, len);
+		}
+	}
+	// True, if server has closed connection and nothing is left unread
+	bool Closed() { return buf_.empty() && !fill(); }
+	int Fd() const { return fd_; }
+
+protected:
+	bool fill() {
+		char tmp[64 << 10];
+		ssize_t n = recv(fd_, tmp, sizeof(tmp), 0);
+		if (n <= 0) return false;
+		buf_.append(tmp, n);
+		return true;
+	}
+	bool readBody(size_t len, std::string &body) {
+		while (buf_.size() < len) {
+			if (!fill()) return false;
+		}
+		body = buf_.substr(0, len);
+		buf_.erase(0, len);
+		return true;
+	}
+
+	int fd_;
+	std::string buf_;
+};
+
+TEST(HttpPipelinedRequestsAreAnsweredInOrder) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	const int kRequests = 100;
+	std::string batch;
+	for (int i = 0; i < kRequests; i++) batch += "GET /echo/" + std::to_string(i) + "?a=1&b=x%20y+z HTTP/1.1\r\nHost: t\r\n\r\n";
+	auto before = srv.listener.GetStats();
+	REQUIRE(sendAll(c.Fd(), batch));
+	for (int i = 0; i < kRequests; i++) {
+		Response resp;
+		REQUIRE(c.Read(resp));
+		CHECK(resp.code == 200 && !resp.close);
+		CHECK(resp.body == std::to_string(i) + "|a=1|b=x y z");
+	}
+	// Responses of requests, which are read together, are sent together
+	auto after = srv.listener.GetStats();
+	CHECK(after.requests - before.requests == kRequests);
+	CHECK(after.writes - before.writes < kRequests / 4);
+	CHECK(after.reads - before.reads < kRequests / 4);
+}
+
+TEST(HttpBodySplitAcrossSends) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	std::string body(40000, 'b');
+	std::string req = "POST /body HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	// Headers and body are split at arbitrary points
+	for (size_t pos = 0; pos < req.size(); pos += 7777) {
+		REQUIRE(sendAll(c.Fd(), req.substr(pos, 7777)));
+		usleep(1000);
+	}
+	Response resp;
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 200 && resp.body == body);
+}
+
+TEST(HttpChunkedResponseAndNotFound) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	REQUIRE(sendAll(c.Fd(), "GET /chunked HTTP/1.1\r\n\r\nGET /missing HTTP/1.1\r\n\r\nGET /chunked HTTP/1.1\r\n\r\n"));
+	Response resp;
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 200 && resp.body == "abcde");
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 404 && resp.body.empty());
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 200 && resp.body == "abcde");
+}
+
+TEST(HttpSlowReaderGetsAllResponses) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	// Responses are far over output limit of connection, so server stops reading until client catches up
+	const int kRequests = 64, kSize = 200000;
+	std::string batch;
+	for (int i = 0; i < kRequests; i++) batch += "GET /big/" + std::to_string(kSize + i) + " HTTP/1.1\r\n\r\n";
+	std::thread sender([&c, &batch]() { sendAll(c.Fd(), batch); });
+	usleep(100000);
+	for (int i = 0; i < kRequests; i++) {
+		Response resp;
+		if (!c.Read(resp)) {
+			CHECK(!"response is read");
+			break;
+		}
+		CHECK(resp.code == 200 && resp.body.size() == size_t(kSize + i));
+	}
+	sender.join();
+}
+
+TEST(HttpPipelinedRequestsBeforeShutdownAreAnswered) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	// Responses are far over output limit and socket buffers, and the client closes its side before reading them
+	const int kRequests = 16, kSize = 1 << 20;
+	std::string batch;
+	for (int i = 0; i < kRequests; i++) batch += "GET /big/" + std::to_string(kSize + i) + " HTTP/1.1\r\n\r\n";
+	REQUIRE(sendAll(c.Fd(), batch));
+	REQUIRE(shutdown(c.Fd(), SHUT_WR) == 0);
+	usleep(100000);
+	for (int i = 0; i < kRequests; i++) {
+		Response resp;
+		if (!c.Read(resp)) {
+			CHECK(!"response is read");
+			break;
+		}
+		CHECK(resp.code == 200 && resp.body.size() == size_t(kSize + i));
+	}
+	CHECK(c.Closed());
+}
+
+TEST(HttpWriterIsCongestedBySlowReader) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	// Client reads nothing, while handler writes. Then it stops far before 256MB, and the rest of response is sent
+	const int kMaxChunks = 65536;
+	REQUIRE(sendAll(c.Fd(), "GET /stream/" + std::to_string(kMaxChunks) + " HTTP/1.1\r\n\r\nGET /echo/1 HTTP/1.1\r\n\r\n"));
+	usleep(100000);
+	Response resp;
+	REQUIRE(c.Read(resp));
+	size_t bar = resp.body.rfind('|');
+	REQUIRE(resp.code == 200 && bar != std::string::npos);
+	int chunks = atoi(resp.body.c_str() + bar + 1);
+	CHECK(chunks > 0 && chunks < kMaxChunks);
+	CHECK(bar == size_t(chunks) * 4096);
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 200 && resp.body == "1");
+}
+
+TEST(HttpMalformedRequestClosesConnection) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	REQUIRE(sendAll(c.Fd(), "GET /echo/1 HTTP/1.1\r\n\r\nGARBAGE\r\n\r\nGET /echo/2 HTTP/1.1\r\n\r\n"));
+	Response resp;
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 200 && resp.body == "1");
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 400 && resp.close);
+	CHECK(c.Closed());
+}
+
+TEST(HttpConnectionClose) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+
+	// Requests after the one with close are not answered
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+	REQUIRE(sendAll(c.Fd(), "GET /echo/1 HTTP/1.1\r\nConnection: close\r\n\r\nGET /echo/2 HTTP/1.1\r\n\r\n"));
+	Response resp;
+	REQUIRE(c.Read(resp));
+	CHECK(resp.code == 200 && resp.close && resp.body == "1");
+	CHECK(c.Closed());
+
+	// HTTP/1.0 closes by default, and response of unknown length is delimited by close
+	Client c10(srv.Connect());
+	REQUIRE(c10.Fd() >= 0);
+	REQUIRE(sendAll(c10.Fd(), "GET /echo/3 HTTP/1.0\r\n\r\n"));
+	REQUIRE(c10.Read(resp));
+	CHECK(resp.code == 200 && resp.close && resp.body == "3");
+	CHECK(c10.Closed());
+
+	// Requests, which client has sent before shutdown of its side, are answered
+	Client half(srv.Connect());
+	REQUIRE(half.Fd() >= 0);
+	REQUIRE(sendAll(half.Fd(), "GET /echo/4 HTTP/1.1\r\n\r\nGET /echo/5 HTTP/1.1\r\n\r\n"));
+	shutdown(half.Fd(), SHUT_WR);
+	REQUIRE(half.Read(resp));
+	CHECK(resp.body == "4");
+	REQUIRE(half.Read(resp));
+	CHECK(resp.body == "5");
+	CHECK(half.Closed());
+}
+
+TEST(HttpManyConnections) {
+	TestServer srv;
+	REQUIRE(srv.ok);
+
+	const int kThreads = 8, kRequests = 200;
+	std::atomic<int> failed(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < kThreads; t++) {
+		threads.emplace_back([&srv, &failed, t]() {
+			for (int i = 0; i < kRequests; i++) {
+				// Connection per request, so closed connections are reused by loops
+				Client c(srv.Connect());
+				std::string id = std::to_string(t * kRequests + i);
+				Response resp;
+				if (!sendAll(c.Fd(), "GET /echo/" + id + " HTTP/1.1\r\n\r\n") || !c.Read(resp) || resp.body != id) failed++;
+			}
+		});
+	}
+	for (auto &t : threads) t.join();
+	CHECK(failed == 0);
+	CHECK(srv.listener.GetStats().accepts == kThreads * kRequests);
+}
+
+TEST(HttpThreadStartIsCalledByEachLoop) {
+	std::mutex mtx;
+	std::set<int> loops;
+	std::set<std::thread::id> threads;
+	{
+		TestServer srv(4, false, [&](int loop) {
+			std::lock_guard<std::mutex> lck(mtx);
+			loops.insert(loop);
+			threads.insert(std::this_thread::get_id());
+		});
+		REQUIRE(srv.ok);
+	}
+	// Loop 0 runs in thread of Run, which is the server thread here
+	CHECK(loops == std::set<int>({0, 1, 2, 3}));
+	CHECK(threads.size() == 4);
+}
+
+TEST(HttpReusePortSocketPerLoop) {
+	const int kLoops = 4, kConns = 64;
+	TestServer srv(kLoops, true);
+	REQUIRE(srv.ok);
+	// Kernel without SO_REUSEPORT falls back to the shared socket
+	CHECK(srv.listener.Sockets() == kLoops || srv.listener.Sockets() == 1);
+
+	std::vector<std::unique_ptr<Client>> clients;
+	for (int i = 0; i < kConns; i++) clients.emplace_back(new Client(srv.Connect()));
+	for (int i = 0; i < kConns; i++) {
+		Response resp;
+		std::string id = std::to_string(i);
+		REQUIRE(clients[i]->Fd() >= 0);
+		REQUIRE(sendAll(clients[i]->Fd(), "GET /echo/" + id + " HTTP/1.1\r\n\r\n") && clients[i]->Read(resp));
+		CHECK(resp.body == id);
+	}
+	CHECK(srv.listener.GetStats().accepts == kConns);
+}
+
+TEST(HttpWakeupLatencyOfParkedLoop) {
+	std::atomic<int> wakeups(0);
+	std::atomic<uint64_t> maxLatency(0);
+	TestServer srv(1, false, nullptr, [&wakeups, &maxLatency](uint64_t us) {
+		wakeups++;
+		if (us > maxLatency) maxLatency = us;
+	});
+	REQUIRE(srv.ok);
+	Client c(srv.Connect());
+	REQUIRE(c.Fd() >= 0);
+
+	// Loop without busy polling is parked, when each request comes
+	for (int i = 0; i < 3; i++) {
+		usleep(20000);
+		REQUIRE(sendAll(c.Fd(), "GET /echo/1 HTTP/1.1\r\n\r\n"));
+		Response resp;
+		REQUIRE(c.Read(resp));
+		CHECK(resp.code == 200);
+	}
+	CHECK(wakeups == 3);
+	CHECK(maxLatency < 1000000);
+}
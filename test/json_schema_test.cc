@@ -0,0 +1,54 @@
+#include <limits.h>
+#include <string>
+#include <vector>
+#include "json_schema.h"
+#include "response_schemas.h"
+#include "test.h"
+
+static std::string escaped(const char *s) {
+	std::string out(jsonschema::EscapedLen(s, strlen(s)), 0);
+	char *end = jsonschema::PutEscaped(&out[0], s, strlen(s));
+	return end == &out[0] + out.size() ? out : "<length mismatch>";
+}
+
+TEST(JsonEscaping) {
+	CHECK(escaped("plain@mail.ru") == "plain@mail.ru");
+	CHECK(escaped("") == "");
+	CHECK(escaped("a\"b\\c") == "a\\\"b\\\\c");
+	CHECK(escaped("\t\n\r") == "\\t\\n\\r");
+	CHECK(escaped("\x01\x1f") == "\\u0001\\u001f");
+	// Multibyte utf-8 is kept as is
+	CHECK(escaped("Москва") == "Москва");
+}
+
+TEST(JsonIntegers) {
+	int vals[] = {0, 1, 9, 10, 99, 100, 12345, 1000000000, INT_MAX, -1, -10, INT_MIN};
+	for (int v : vals) {
+		char buf[16];
+		char *end = jsonschema::PutInt(buf, v);
+		CHECK(std::string(buf, end) == std::to_string(v));
+		CHECK(jsonschema::IntLen(v) == std::to_string(v).size());
+	}
+}
+
+TEST(JsonUserIsEscaped) {
+	StringDict dict;
+	StoredUser u{7, -100, "o\"neil@mail.ru", dict.Put("Sean \"Jr\""), dict.Put("O'Neil"), dict.Put("m")};
+	std::string out;
+	jsonschema::Render<UserJSON::Schema>(u, dict, out);
+	CHECK(out ==
+		  "{\"id\":7,\"gender\":\"m\",\"first_name\":\"Sean \\\"Jr\\\"\",\"last_name\":\"O'Neil\",\"birth_date\":-100,"
+		  "\"email\":\"o\\\"neil@mail.ru\"}");
+}
+
+TEST(JsonVisitPlaceList) {
+	StringDict dict;
+	std::vector<VisitPlace> rows{VisitPlace{100, 5, dict.Put("Park")}, VisitPlace{-1, 0, dict.Put("Back\\slash")}};
+	std::string out;
+	jsonschema::RenderList<VisitPlaceJSON::Schema>("{\"visits\":[", rows.data(), rows.data() + rows.size(), dict, out);
+	CHECK(out ==
+		  "{\"visits\":[{\"visited_at\":100,\"mark\":5,\"place\":\"Park\"},"
+		  "{\"visited_at\":-1,\"mark\":0,\"place\":\"Back\\\\slash\"}]}");
+	jsonschema::RenderList<VisitPlaceJSON::Schema>("{\"visits\":[", rows.data(), rows.data(), dict, out);
+	CHECK(out == "{\"visits\":[]}");
+}
@@ -0,0 +1,101 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <vector>
+#include "kernels.h"
+#include "test.h"
+
+using namespace kernels;
+
+// Columns and filter of one random scan
+struct Scan {
+	std::vector<int32_t> col;
+	std::vector<char> gender;
+	std::vector<int8_t> mark;
+	int32_t lo, hi;
+	char val;
+	bool byRange, byGender;
+};
+
+static Scan randomScan(unsigned &seed) {
+	Scan s;
+	int n = 1 + rand_r(&seed) % 700;
+	for (int i = 0; i < n; i++) {
+		s.col.push_back(rand_r(&seed) % 200 - 100);
+		s.gender.push_back(rand_r(&seed) % 2 ? 'm' : 'f');
+		s.mark.push_back(rand_r(&seed) % 6);
+	}
+	s.lo = rand_r(&seed) % 4 ? rand_r(&seed) % 200 - 100 : INT_MIN;
+	s.hi = rand_r(&seed) % 4 ? rand_r(&seed) % 200 - 100 : INT_MAX;
+	s.val = rand_r(&seed) % 2 ? 'm' : 'f';
+	s.byRange = rand_r(&seed) % 4;
+	s.byGender = rand_r(&seed) % 2;
+	return s;
+}
+
+static void scalarReference(const Scan &s, int64_t &sum, int &count) {
+	for (size_t i = 0; i < s.col.size(); i++) {
+		if (s.byRange && !(s.col[i] > s.lo && s.col[i] < s.hi)) continue;
+		if (s.byGender && s.gender[i] != s.val) continue;
+		sum += s.mark[i];
+		count++;
+	}
+}
+
+static void run(const Scan &s, std::vector<uint64_t> &mask, int64_t &sum, int &count) {
+	int n = s.col.size();
+	mask.assign(MaskWords(n), ~uint64_t(0));
+	InitMask(mask.data(), n);
+	if (s.byRange) AndRange(s.col.data(), n, s.lo, s.hi, mask.data());
+	if (s.byGender) AndEq(s.gender.data(), n, s.val, mask.data());
+	MaskedSum(s.mark.data(), n, mask.data(), sum, count);
+}
+
+TEST(KernelsMatchScalarReference) {
+	Impl saved = GetImpl();
+	unsigned seed = 1;
+	for (int it = 0; it < 3000; it++) {
+		Scan s = randomScan(seed);
+		int64_t refSum = 5;
+		int refCount = 3;
+		scalarReference(s, refSum, refCount);
+
+		for (Impl impl : {ImplScalar, ImplSSE41, ImplAVX2}) {
+			if (!SetImpl(impl)) continue;
+			std::vector<uint64_t> mask;
+			int64_t sum = 5;
+			int count = 3;
+			run(s, mask, sum, count);
+			CHECK(sum == refSum);
+			CHECK(count == refCount);
+			// Bits past the last row must stay clear
+			int n = s.col.size();
+			if (n % 64) CHECK(!(mask.back() >> (n % 64)));
+			if (sum != refSum || count != refCount) {
+				fprintf(stderr, "%s, %d rows\n", ImplName(impl), n);
+				SetImpl(saved);
+				return;
+			}
+		}
+	}
+	SetImpl(saved);
+}
+
+TEST(KernelsBoundsAreExclusive) {
+	Impl saved = GetImpl();
+	std::vector<int32_t> col(100);
+	for (int i = 0; i < 100; i++) col[i] = i;
+	for (Impl impl : {ImplScalar, ImplSSE41, ImplAVX2}) {
+		if (!SetImpl(impl)) continue;
+		std::vector<uint64_t> mask(MaskWords(100));
+		InitMask(mask.data(), 100);
+		AndRange(col.data(), 100, 10, 20, mask.data());
+		int bits = 0;
+		for (int i = 0; i < 100; i++) {
+			bool set = mask[i / 64] >> (i % 64) & 1;
+			bits += set;
+			CHECK(set == (i > 10 && i < 20));
+		}
+		CHECK(bits == 9);
+	}
+	SetImpl(saved);
+}
@@ -0,0 +1,70 @@
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "lru_cache.h"
+#include "test.h"
+
+static bool get(LruCache<int> &c, const char *key, int &val) { return c.Get(key, strlen(key), val); }
+static void put(LruCache<int> &c, const char *key, int val) { c.Put(key, strlen(key), val); }
+
+TEST(LruCacheEvictsLeastRecentlyUsed) {
+	LruCache<int> c(2);
+	int val = 0;
+	put(c, "a", 1);
+	put(c, "b", 2);
+	// Hit makes "a" the most recently used, so "b" is evicted by "c"
+	CHECK(get(c, "a", val) && val == 1);
+	put(c, "c", 3);
+	CHECK(c.Size() == 2);
+	CHECK(!get(c, "b", val));
+	CHECK(get(c, "a", val) && val == 1);
+	CHECK(get(c, "c", val) && val == 3);
+	CHECK(c.Hits() == 3 && c.Misses() == 1);
+}
+
+TEST(LruCacheReplacesValue) {
+	LruCache<int> c(2);
+	int val = 0;
+	put(c, "a", 1);
+	put(c, "b", 2);
+	put(c, "a", 10);
+	CHECK(c.Size() == 2);
+	CHECK(get(c, "a", val) && val == 10);
+	// Replace makes entry the most recently used too
+	put(c, "b", 20);
+	put(c, "c", 3);
+	CHECK(!get(c, "a", val));
+	CHECK(get(c, "b", val) && val == 20);
+}
+
+TEST(LruCacheComparesKeys) {
+	LruCache<int> c(4);
+	int val = 0;
+	// Key is compared by length too, so prefix of cached key is a miss
+	put(c, "abc", 1);
+	CHECK(!c.Get("abcd", 2, val));
+	CHECK(c.Get("abcd", 3, val) && val == 1);
+	CHECK(!get(c, "abd", val));
+}
+
+TEST(LruCacheConcurrentAccess) {
+	LruCache<std::string> c(64);
+	std::vector<std::thread> threads;
+	std::atomic<int> wrong(0);
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&c, &wrong, t]() {
+			for (int i = 0; i < 20000; i++) {
+				std::string key = "key" + std::to_string((i * 7 + t) % 100), val;
+				if (c.Get(key.data(), key.size(), val)) {
+					if (val != "val" + key) wrong++;
+				} else {
+					c.Put(key.data(), key.size(), "val" + key);
+				}
+			}
+		});
+	}
+	for (auto &th : threads) th.join();
+	CHECK(!wrong.load());
+	CHECK(c.Size() <= 64);
+}
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include "request_arena.h"
+#include "test.h"
+
+TEST(RequestArenaAlignsAndReuses) {
+	RequestArena arena;
+	char *first = static_cast<char *>(arena.Alloc(1));
+	char *second = static_cast<char *>(arena.Alloc(24));
+	CHECK(uintptr_t(first) % 16 == 0 && uintptr_t(second) % 16 == 0);
+	CHECK(second == first + 16);
+	CHECK(arena.Capacity() == 64 << 10);
+
+	// Single chunk is kept, and the next request starts from its beginning
+	arena.Reset();
+	CHECK(arena.Alloc(8) == first);
+	CHECK(arena.Capacity() == 64 << 10);
+}
+
+TEST(RequestArenaMergesChunksOnReset) {
+	RequestArena arena;
+	for (int i = 0; i < 10; i++) memset(arena.Alloc(30 << 10), i, 30 << 10);
+	size_t grown = arena.Capacity();
+	CHECK(grown > 64 << 10);
+
+	// Request, which needed several chunks, fits in one chunk of the same size next time
+	arena.Reset();
+	CHECK(arena.Capacity() == grown);
+	char *p = static_cast<char *>(arena.Alloc(300 << 10));
+	CHECK(static_cast<char *>(arena.Alloc(16)) == p + (300 << 10));
+	CHECK(arena.Capacity() == grown);
+}
+
+TEST(RequestArenaShrinksAfterLargeRequest) {
+	RequestArena arena;
+	memset(arena.Alloc(8 << 20), 1, 8 << 20);
+	CHECK(arena.Capacity() >= 8 << 20);
+	// Memory over 1MB is not kept for later requests
+	arena.Reset();
+	CHECK(arena.Capacity() == 1 << 20);
+}
+
+TEST(RequestArenaContainers) {
+	RequestArena arena;
+	ArenaString s{ArenaAllocator<char>(arena)};
+	for (int i = 0; i < 1000; i++) s += "0123456789";
+	CHECK(s.size() == 10000 && s.compare(9990, 10, "0123456789") == 0);
+
+	ArenaVector<int> v{ArenaAllocator<int>(arena)};
+	for (int i = 0; i < 10000; i++) v.push_back(i);
+	bool ok = true;
+	for (int i = 0; i < 10000; i++) ok = ok && v[i] == i;
+	CHECK(ok);
+}
+
+TEST(RequestArenaScopeResetsLocalArena) {
+	RequestArena &local = RequestArena::Local();
+	void *first;
+	{
+		RequestArena::Scope scope;
+		first = local.Alloc(100);
+	}
+	{
+		RequestArena::Scope scope;
+		CHECK(local.Alloc(100) == first);
+	}
+
+	// Each thread has own arena
+	RequestArena *other = nullptr;
+	std::thread([&other]() { other = &RequestArena::Local(); }).join();
+	CHECK(other != &local);
+}
@@ -0,0 +1,173 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "result_cache.h"
+#include "test.h"
+
+static ResultCache::Key userKey(int id, int fromDate = 0) {
+	return ResultCache::Key{ResultCache::KindUserVisits, id, {fromDate, 0, 0, 0, 0}};
+}
+
+static bool get(ResultCache &c, const ResultCache::Key &key, std::string &body) {
+	const char *data;
+	size_t len;
+	if (!c.Get(key, c.Version(ResultCache::Kind(key.kind), key.id), data, len)) return false;
+	body.assign(data, len);
+	return true;
+}
+
+static void put(ResultCache &c, const ResultCache::Key &key, const std::string &body) {
+	c.Put(key, c.Version(ResultCache::Kind(key.kind), key.id), body.data(), body.size());
+}
+
+TEST(ResultCacheDisabled) {
+	EpochManager em;
+	ResultCache c(em);
+	EpochManager::Guard guard(em);
+	std::string body;
+	put(c, userKey(1), "a");
+	CHECK(!get(c, userKey(1), body));
+	CHECK(c.GetStats().entries == 0);
+}
+
+TEST(ResultCacheBumpMakesStale) {
+	EpochManager em;
+	ResultCache c(em);
+	c.SetCapacity(1 << 20);
+	EpochManager::Guard guard(em);
+	std::string body;
+
+	put(c, userKey(1), "user1");
+	put(c, userKey(1, 100), "user1 from 100");
+	put(c, userKey(2), "user2");
+	CHECK(get(c, userKey(1), body) && body == "user1");
+	CHECK(get(c, userKey(1, 100), body) && body == "user1 from 100");
+
+	// All filters of entity are stale after its update, and other entities and kinds are not affected
+	c.Bump(ResultCache::KindUserVisits, 1);
+	c.Bump(ResultCache::KindLocationAvg, 2);
+	CHECK(!get(c, userKey(1), body));
+	CHECK(!get(c, userKey(1, 100), body));
+	CHECK(get(c, userKey(2), body) && body == "user2");
+	auto st = c.GetStats();
+	CHECK(st.hits == 3 && st.stale == 2 && st.misses == 2);
+	CHECK(st.entries == 1);
+
+	put(c, userKey(1), "user1 v2");
+	CHECK(get(c, userKey(1), body) && body == "user1 v2");
+}
+
+TEST(ResultCacheOlderVersionDoesNotReplaceNewer) {
+	EpochManager em;
+	ResultCache c(em);
+	c.SetCapacity(1 << 20);
+	EpochManager::Guard guard(em);
+	std::string body;
+
+	// Reader took version before update, and rendered its result after result of the new version was cached
+	uint32_t before = c.Version(ResultCache::KindUserVisits, 1);
+	c.Bump(ResultCache::KindUserVisits, 1);
+	put(c, userKey(1), "new");
+	c.Put(userKey(1), before, "old", 3);
+	CHECK(get(c, userKey(1), body) && body == "new");
+
+	// Lookup with the old version is a miss, but does not drop the newer entry
+	const char *data;
+	size_t len;
+	CHECK(!c.Get(userKey(1), before, data, len));
+	CHECK(get(c, userKey(1), body) && body == "new");
+}
+
+TEST(ResultCacheStaysUnderCap) {
+	EpochManager em;
+	ResultCache c(em);
+	const size_t kCap = 64 << 10;
+	c.SetCapacity(kCap);
+	std::string body(200, 'x'), got;
+	int hotHits = 0;
+	for (int i = 0; i < 10000; i++) {
+		EpochManager::Guard guard(em);
+		put(c, userKey(i + 2), body);
+		// Referenced entry survives eviction sweeps
+		if (get(c, userKey(1), got)) {
+			hotHits++;
+		} else {
+			put(c, userKey(1), "hot");
+		}
+	}
+	em.Collect();
+	auto st = c.GetStats();
+	CHECK(st.bytes <= kCap + 1024);
+	CHECK(st.evictions > 0);
+	CHECK(hotHits > 9000);
+	CHECK(em.Pending() == 0);
+}
+
+TEST(ResultCacheBodyIsValidWhileGuarded) {
+	EpochManager em;
+	ResultCache c(em);
+	c.SetCapacity(1 << 20);
+	const char *data;
+	size_t len;
+	{
+		EpochManager::Guard guard(em);
+		put(c, userKey(1), "first");
+		REQUIRE(c.Get(userKey(1), c.Version(ResultCache::KindUserVisits, 1), data, len));
+
+		// Other thread replaces entry and collects, while this one still reads the old body
+		std::thread([&c, &em]() {
+			EpochManager::Guard guard(em);
+			c.Bump(ResultCache::KindUserVisits, 1);
+			put(c, userKey(1), "second");
+		}).join();
+		em.Collect();
+		CHECK(std::string(data, len) == "first");
+		CHECK(em.Pending() == 1);
+	}
+	em.Collect();
+	CHECK(em.Pending() == 0);
+}
+
+TEST(ResultCacheConcurrentReadersAndWriters) {
+	EpochManager em;
+	ResultCache c(em);
+	c.SetCapacity(256 << 10);
+	std::atomic<bool> stop(false);
+	std::atomic<int> bad(0);
+
+	// Body of entry is id and version it was rendered at, so hit must return body of the version asked
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&c, &em, &stop, &bad, t]() {
+			unsigned seed = t;
+			while (!stop) {
+				EpochManager::Guard guard(em);
+				int id = rand_r(&seed) % 2000;
+				uint32_t version = c.Version(ResultCache::KindUserVisits, id);
+				std::string expect = std::to_string(id) + ":" + std::to_string(version) + std::string(id % 300, '.');
+				const char *data;
+				size_t len;
+				if (c.Get(userKey(id), version, data, len)) {
+					if (std::string(data, len) != expect) bad++;
+				} else {
+					c.Put(userKey(id), version, expect.data(), expect.size());
+				}
+				if (rand_r(&seed) % 16 == 0) c.Bump(ResultCache::KindUserVisits, id);
+			}
+		});
+	}
+	threads.emplace_back([&em, &stop]() {
+		while (!stop) em.Collect();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	stop = true;
+	for (auto &t : threads) t.join();
+	em.Collect();
+
+	auto st = c.GetStats();
+	CHECK(bad == 0);
+	CHECK(st.hits > 0 && st.stale > 0);
+	CHECK(st.bytes <= (256 << 10) + 4096);
+	CHECK(em.Pending() == 0);
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "snapshot.h"
+#include "test.h"
+
+static std::string tmpPath(const char *name) { return "/tmp/hlcup_snapshot_test_" + std::to_string(getpid()) + "_" + name; }
+
+static bool writeSample(const std::string &path, uint64_t signature) {
+	std::vector<User> users{{1, 100, "m", "Иван", "Петров", "ivan@mail.ru"}, {2, -200, "f", "", "Doe", "jane@doe.com"}};
+	std::vector<Location> locations{{5, 10, "Парк", "Москва", "Россия"}};
+	std::vector<Visit> visits{{1, 1, 5, 300, 3}, {2, 2, 5, 100, 0}, {3, 1, 5, 200, 5}};
+	return Snapshot::Write(path, signature, users, locations, visits);
+}
+
+TEST(SnapshotRoundTrip) {
+	std::string path = tmpPath("roundtrip");
+	REQUIRE(writeSample(path, 42));
+	CHECK(access((path + ".tmp").c_str(), F_OK) < 0);
+
+	Snapshot s;
+	REQUIRE(s.Open(path, 42));
+	REQUIRE(s.Users().size() == 2 && s.Locations().size() == 1 && s.Visits().size() == 3);
+	const User &u = s.Users()[1];
+	CHECK(u.id == 2 && u.birth_date == -200);
+	CHECK(!strcmp(u.gender, "f") && !strcmp(u.first_name, "") && !strcmp(u.last_name, "Doe"));
+	CHECK(!strcmp(u.email, "jane@doe.com"));
+	CHECK(!strcmp(s.Users()[0].first_name, "Иван"));
+	const Location &l = s.Locations()[0];
+	CHECK(l.id == 5 && l.distance == 10 && !strcmp(l.place, "Парк") && !strcmp(l.city, "Москва") && !strcmp(l.country, "Россия"));
+	const Visit &v = s.Visits()[2];
+	CHECK(v.id == 3 && v.user == 1 && v.location == 5 && v.visited_at == 200 && v.mark == 5);
+	unlink(path.c_str());
+}
+
+TEST(SnapshotOfOtherDataIsRejected) {
+	std::string path = tmpPath("signature");
+	REQUIRE(writeSample(path, 42));
+	Snapshot s;
+	CHECK(!s.Open(path, 43));
+	unlink(path.c_str());
+}
+
+TEST(CorruptedSnapshotIsRejected) {
+	std::string path = tmpPath("corrupted");
+	// Header is 48 bytes, with checksum in the last 8. Byte of strings, of the first record and of checksum are flipped in turn
+	for (long pos : {-2L, 52L, 40L}) {
+		REQUIRE(writeSample(path, 42));
+		FILE *f = fopen(path.c_str(), "r+b");
+		REQUIRE(f);
+		fseek(f, pos, pos < 0 ? SEEK_END : SEEK_SET);
+		int c = fgetc(f);
+		fseek(f, -1, SEEK_CUR);
+		fputc(c ^ 0x20, f);
+		fclose(f);
+
+		Snapshot s;
+		CHECK(!s.Open(path, 42));
+	}
+	unlink(path.c_str());
+}
+
+TEST(TruncatedSnapshotIsRejected) {
+	std::string path = tmpPath("truncated");
+	REQUIRE(writeSample(path, 42));
+	FILE *f = fopen(path.c_str(), "rb");
+	REQUIRE(f);
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	for (long len : {size - 1, 20L, 0L}) {
+		REQUIRE(truncate(path.c_str(), len) == 0);
+		Snapshot s;
+		CHECK(!s.Open(path, 42));
+	}
+	unlink(path.c_str());
+}
+
+TEST(MissingSnapshotIsRejected) {
+	Snapshot s;
+	CHECK(!s.Open(tmpPath("missing"), 42));
+}
@@ -0,0 +1,130 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "store.h"
+#include "test.h"
+
+// One user with one visit of one location
+static bool loadStore(Store &store) {
+	std::vector<User> users{User{1, 100, "m", "Ivan", "Petrov", "ivan@mail.ru"}};
+	std::vector<Location> locations{Location{1, 10, "Park", "Moscow", "Russia"}};
+	std::vector<Visit> visits{Visit{1, 1, 1, 1000, 3}};
+	return store.Load(users, locations, visits);
+}
+
+TEST(StoreUpdatedRecordsAreRetired) {
+	Store store;
+	REQUIRE(loadStore(store));
+	EpochManager::Guard guard(store.Epochs());
+	size_t pending = store.Epochs().Pending();
+
+	// The first update moves record out of page to a copy, and record in page stays allocated
+	REQUIRE(store.PutLocation(Location{1, 20, "Park", "Moscow", "Russia"}));
+	CHECK(store.Epochs().Pending() == pending);
+	auto l = store.GetLocation(1);
+	REQUIRE(l);
+	CHECK(l->distance == 20);
+
+	// The next one replaces the copy, which readers may still hold
+	REQUIRE(store.PutLocation(Location{1, 30, "Garden", "Moscow", "Russia"}));
+	CHECK(store.Epochs().Pending() == pending + 1);
+	CHECK(l->distance == 20);
+	l = store.GetLocation(1);
+	REQUIRE(l);
+	CHECK(l->distance == 30 && std::string(store.Dict().Str(l->place)) == "Garden");
+}
+
+TEST(StoreRetiredRecordsAreFreedAfterReaders) {
+	Store store;
+	REQUIRE(loadStore(store));
+	{
+		EpochManager::Guard guard(store.Epochs());
+		for (int i = 0; i < 10; i++) REQUIRE(store.PutLocation(Location{1, i, "Park", "Moscow", "Russia"}));
+		store.CollectGarbage();
+		// This thread is still pinned
+		CHECK(store.Epochs().Pending() >= 9);
+	}
+	store.CollectGarbage();
+	CHECK(store.Epochs().Pending() == 0);
+}
+
+TEST(StoreUserUpdatePatchesLocationVisits) {
+	Store store;
+	REQUIRE(loadStore(store));
+	EpochManager::Guard guard(store.Epochs());
+	REQUIRE(store.PutUser(User{1, 200, "f", "Anna", "Petrova", "anna@mail.ru"}));
+	auto u = store.GetUser(1);
+	REQUIRE(u);
+	CHECK(u->birth_date == 200 && std::string(u->email) == "anna@mail.ru");
+	auto lv = store.GetLocationVisits(1);
+	REQUIRE(lv && lv->size == 1);
+	CHECK(lv->At(0).birth_date == 200 && lv->At(0).gender == 'f');
+}
+
+TEST(StoreNewUserPatchesLocationVisits) {
+	Store store;
+	REQUIRE(loadStore(store));
+	EpochManager::Guard guard(store.Epochs());
+	// Visit of user, who is not created yet, is indexed without visitor's attributes
+	REQUIRE(store.PutVisit(Visit{2, 2, 1, 2000, 4}));
+	auto lv = store.GetLocationVisits(1);
+	REQUIRE(lv && lv->size == 2);
+	CHECK(lv->At(1).visit == 2 && lv->At(1).gender == '\0');
+
+	REQUIRE(store.PutUser(User{2, 300, "f", "Anna", "Petrova", "anna@mail.ru"}));
+	lv = store.GetLocationVisits(1);
+	REQUIRE(lv && lv->size == 2);
+	CHECK(lv->At(1).visit == 2 && lv->At(1).birth_date == 300 && lv->At(1).gender == 'f');
+}
+
+TEST(StoreReadersDuringUpdates) {
+	Store store;
+	REQUIRE(loadStore(store));
+	std::atomic<bool> stop(false);
+	std::atomic<int> bad(0);
+
+	std::vector<std::thread> threads;
+	for (int r = 0; r < 4; r++) {
+		threads.emplace_back([&]() {
+			int last = 0;
+			while (!stop) {
+				EpochManager::Guard guard(store.Epochs());
+				// Writer only increases distance and moves visit between two locations
+				auto l = store.GetLocation(1);
+				if (!l || l->distance < last || std::string(store.Dict().Str(l->place)) != "Park") bad++;
+				if (l) last = l->distance;
+				auto timeline = store.GetUserVisits(1);
+				if (!timeline || timeline->size != 1) {
+					bad++;
+					continue;
+				}
+				for (auto &v : *timeline) {
+					if (v.LocationId() != 1 && v.LocationId() != 2) bad++;
+				}
+			}
+		});
+	}
+	threads.emplace_back([&]() {
+		while (!stop) store.CollectGarbage();
+	});
+
+	{
+		EpochManager::Guard guard(store.Epochs());
+		REQUIRE(store.PutLocation(Location{2, 1, "Park", "Kazan", "Russia"}));
+	}
+	for (int i = 11; i < 20000; i++) {
+		EpochManager::Guard guard(store.Epochs());
+		if (!store.PutLocation(Location{1, i, "Park", "Moscow", "Russia"})) bad++;
+		if (!store.PutVisit(Visit{1, 1, 1 + i % 2, 1000 + i, i % 5 + 1})) bad++;
+	}
+	stop = true;
+	for (auto &t : threads) t.join();
+	store.CollectGarbage();
+
+	CHECK(bad == 0);
+	CHECK(store.Epochs().Pending() == 0);
+	auto v = store.GetVisit(1);
+	REQUIRE(v);
+	CHECK(v->LocationId() == 2 && v->Mark() == 5);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+// Minimal unit tests: TEST registers a case, CHECK reports a failed condition and fails the case.
+// Each test binary is one *_test.cc linked with test_main.cc, which runs all registered cases
+namespace test {
+
+struct Case {
+	const char *name;
+	void (*func)();
+};
+
+std::vector<Case> &Cases();
+// Failed checks of running case
+int &Failures();
+
+struct Register {
+	Register(const char *name, void (*func)()) { Cases().push_back(Case{name, func}); }
+};
+
+}  // namespace test
+
+#define TEST(name)                                             \
+	static void test_##name();                                 \
+	static test::Register register_##name(#name, test_##name); \
+	static void test_##name()
+
+#define CHECK(cond)                                                                  \
+	do {                                                                             \
+		if (!(cond)) {                                                               \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			test::Failures()++;                                                      \
+		}                                                                            \
+	} while (0)
+
+// Stops the case on failure, when the rest of it depends on condition
+#define REQUIRE(cond)    \
+	do {                 \
+		if (!(cond)) {   \
+			CHECK(cond); \
+			return;      \
+		}                \
+	} while (0)
@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include "test.h"
+
+namespace test {
+
+std::vector<Case> &Cases() {
+	static std::vector<Case> cases;
+	return cases;
+}
+
+int &Failures() {
+	static int failures = 0;
+	return failures;
+}
+
+}  // namespace test
+
+int main() {
+	int failed = 0;
+	for (auto &c : test::Cases()) {
+		test::Failures() = 0;
+		c.func();
+		printf("%s %s\n", test::Failures() ? "FAIL" : "ok  ", c.name);
+		if (test::Failures()) failed++;
+	}
+	printf("%d of %d cases failed\n", failed, int(test::Cases().size()));
+	return failed ? 1 : 0;
+}
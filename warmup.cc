@@ -0,0 +1,102 @@
+#include "warmup.h"
+#include <limits.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include "store.h"
+
+TlbMissCounter::TlbMissCounter() {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+TlbMissCounter::~TlbMissCounter() {
+	if (fd_ >= 0) close(fd_);
+}
+
+void TlbMissCounter::Start() {
+	if (fd_ < 0) return;
+	ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+uint64_t TlbMissCounter::Stop() {
+	uint64_t count = 0;
+	if (fd_ < 0) return 0;
+	ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd_, &count, sizeof(count)) != sizeof(count)) return 0;
+	return count;
+}
+
+// Sum of read values is stored here, so reads are not optimized out
+static volatile int64_t probeSink;
+
+static int64_t probeRead(const Store &store, int kind, unsigned &seed) {
+	int users = std::max(1, int(store.UsersCount())), locations = std::max(1, int(store.LocationsCount())),
+		visits = std::max(1, int(store.VisitsCount()));
+	int64_t sink = 0;
+	switch (kind) {
+		case 0: {
+			auto u = store.GetUser(1 + rand_r(&seed) % users);
+			if (u) sink += u->birth_date + store.Dict().Get(u->first_name).len;
+			break;
+		}
+		case 1: {
+			auto l = store.GetLocation(1 + rand_r(&seed) % locations);
+			if (l) sink += l->distance + store.Dict().Get(l->city).len;
+			break;
+		}
+		case 2: {
+			auto v = store.GetVisit(1 + rand_r(&seed) % visits);
+			if (v) sink += v->visited_at + v->Mark();
+			break;
+		}
+		case 3: {
+			// Like /users/<id>/visits with country filter: location of each visit is looked up
+			auto t = store.GetUserVisits(1 + rand_r(&seed) % users);
+			if (!t) break;
+			for (auto &v : *t) {
+				auto l = store.GetLocation(v.LocationId());
+				if (l) sink += l->country;
+			}
+			break;
+		}
+		case 4: {
+			auto l = store.GetLocationVisits(1 + rand_r(&seed) % locations);
+			if (!l) break;
+			int64_t sum;
+			int count;
+			l->Aggregate(AvgFilter{0, INT_MAX, INT_MIN, INT_MAX, 'f'}, sum, count);
+			sink += sum + count;
+			break;
+		}
+	}
+	return sink;
+}
+
+StoreProbe ProbeStore(const Store &store, int reads, unsigned seed) {
+	EpochManager::Guard guard(store.Epochs());
+	TlbMissCounter tlb;
+	int64_t sink = 0;
+	auto tmStart = std::chrono::steady_clock::now();
+	tlb.Start();
+	for (int i = 0; i < reads; i++) sink += probeRead(store, i % 5, seed);
+	uint64_t misses = tlb.Stop();
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tmStart).count();
+
+	probeSink = sink;
+	reads = std::max(reads, 1);
+	return StoreProbe{double(us) / reads, tlb.Valid() ? double(misses) / reads : -1};
+}
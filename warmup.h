@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+class Store;
+
+// Counter of data TLB misses of calling thread, by perf events. It's not valid if perf events are not
+// permitted, e.g. in container or with kernel.perf_event_paranoid > 2
+class TlbMissCounter {
+public:
+	TlbMissCounter();
+	~TlbMissCounter();
+	TlbMissCounter(const TlbMissCounter &) = delete;
+	TlbMissCounter &operator=(const TlbMissCounter &) = delete;
+
+	bool Valid() const { return fd_ >= 0; }
+	void Start();
+	// Returns misses since Start
+	uint64_t Stop();
+
+protected:
+	int fd_;
+};
+
+// Mean cost of random reads of store, like GET handlers do: entities, user timelines and location averages
+struct StoreProbe {
+	double usPerRead;
+	// Negative if TLB misses can't be counted
+	double tlbMissesPerRead;
+};
+
+StoreProbe ProbeStore(const Store &store, int reads, unsigned seed);